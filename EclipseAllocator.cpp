@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseAllocator.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+
+EclipseAllocator::EclipseAllocator(uint64 memoryLimit) :
+_chunkCursor(nullptr),
+_chunkRemaining(0),
+_keptLargeBlocks(0),
+_memoryLimit(memoryLimit),
+_usedBytes(0),
+_peakBytes(0),
+_reservedBytes(0),
+_failedAllocations(0)
+{
+    _freeLists.fill(nullptr);
+}
+
+EclipseAllocator::~EclipseAllocator()
+{
+    for (void* chunk : _chunks)
+        std::free(chunk);
+}
+
+/**
+ *
+ */
+void* EclipseAllocator::Allocate(void* ud, void* ptr, std::size_t osize, std::size_t nsize)
+{
+    // When ptr is null, osize carries the type of the object being created, not a size
+    return static_cast<EclipseAllocator*>(ud)->Reallocate(ptr, ptr ? osize : 0, nsize);
+}
+
+/**
+ *
+ */
+void* EclipseAllocator::Reallocate(void* ptr, std::size_t oldSize, std::size_t newSize)
+{
+    if (!newSize)
+    {
+        if (ptr)
+        {
+            ReleaseBlock(ptr, oldSize);
+            AddUsedBytes(-static_cast<int64>(oldSize));
+        }
+        return nullptr;
+    }
+
+    // Returning null makes Lua run an emergency collection and raise a memory error if that is not enough
+    if (_memoryLimit && newSize > oldSize && GetUsedBytes() + (newSize - oldSize) > _memoryLimit)
+    {
+        _failedAllocations.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    void* newPtr;
+    if (ptr && oldSize > SMALL_BLOCK_LIMIT && newSize > SMALL_BLOCK_LIMIT)
+        newPtr = std::realloc(ptr, newSize);
+    else if (ptr && oldSize <= SMALL_BLOCK_LIMIT && newSize <= SMALL_BLOCK_LIMIT && GetSizeClass(oldSize) == GetSizeClass(newSize))
+        newPtr = ptr;
+    else
+    {
+        newPtr = AllocateBlock(newSize);
+        if (newPtr && ptr)
+        {
+            std::memcpy(newPtr, ptr, std::min(oldSize, newSize));
+            ReleaseBlock(ptr, oldSize);
+        }
+    }
+
+    // Lua takes a shrink as unable to fail, the old block is large enough to stay where it is
+    if (!newPtr && ptr && newSize <= oldSize)
+    {
+        if (oldSize > SMALL_BLOCK_LIMIT && newSize <= SMALL_BLOCK_LIMIT)
+            ++_keptLargeBlocks;
+
+        newPtr = ptr;
+    }
+
+    if (!newPtr)
+    {
+        _failedAllocations.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    AddUsedBytes(static_cast<int64>(newSize) - static_cast<int64>(oldSize));
+    return newPtr;
+}
+
+/**
+ *
+ */
+void* EclipseAllocator::AllocateBlock(std::size_t size)
+{
+    if (size > SMALL_BLOCK_LIMIT)
+        return std::malloc(size);
+
+    return AllocateSmall(GetSizeClass(size));
+}
+
+/**
+ * The size Lua reports may be smaller than the block after a kept shrink, a small block then goes to the
+ * free list of a smaller class it still fits, a heap block is told apart by not lying in any chunk
+ */
+void EclipseAllocator::ReleaseBlock(void* ptr, std::size_t size)
+{
+    if (size > SMALL_BLOCK_LIMIT)
+    {
+        std::free(ptr);
+        return;
+    }
+
+    if (_keptLargeBlocks && !OwnsBlock(ptr))
+    {
+        --_keptLargeBlocks;
+        std::free(ptr);
+        return;
+    }
+
+    std::size_t sizeClass = GetSizeClass(size);
+    FreeBlock* block = static_cast<FreeBlock*>(ptr);
+    block->next = _freeLists[sizeClass];
+    _freeLists[sizeClass] = block;
+}
+
+/**
+ *
+ */
+void* EclipseAllocator::AllocateSmall(std::size_t sizeClass)
+{
+    if (FreeBlock* block = _freeLists[sizeClass])
+    {
+        _freeLists[sizeClass] = block->next;
+        return block;
+    }
+
+    std::size_t blockSize = (sizeClass + 1) * SIZE_CLASS_STEP;
+    if (_chunkRemaining < blockSize)
+    {
+        // Hand the tail of the current chunk to the free lists before starting a new one
+        while (_chunkRemaining >= SIZE_CLASS_STEP)
+        {
+            std::size_t tailClass = std::min(_chunkRemaining / SIZE_CLASS_STEP - 1, SIZE_CLASS_COUNT - 1);
+            std::size_t tailSize = (tailClass + 1) * SIZE_CLASS_STEP;
+            ReleaseBlock(_chunkCursor, tailSize);
+            _chunkCursor += tailSize;
+            _chunkRemaining -= tailSize;
+        }
+
+        char* chunk = static_cast<char*>(std::malloc(CHUNK_SIZE));
+        if (!chunk)
+            return nullptr;
+
+        try
+        {
+            _chunks.insert(std::upper_bound(_chunks.begin(), _chunks.end(), chunk, std::less<void*>()), chunk);
+        }
+        catch (const std::bad_alloc&)
+        {
+            std::free(chunk);
+            return nullptr;
+        }
+
+        _chunkCursor = chunk;
+        _chunkRemaining = CHUNK_SIZE;
+        _reservedBytes.fetch_add(CHUNK_SIZE, std::memory_order_relaxed);
+    }
+
+    void* block = _chunkCursor;
+    _chunkCursor += blockSize;
+    _chunkRemaining -= blockSize;
+    return block;
+}
+
+/**
+ *
+ */
+bool EclipseAllocator::OwnsBlock(void* ptr) const
+{
+    auto it = std::upper_bound(_chunks.begin(), _chunks.end(), ptr, std::less<void*>());
+    if (it == _chunks.begin())
+        return false;
+
+    char* chunk = static_cast<char*>(*--it);
+    return std::less_equal<void*>()(chunk, ptr) && std::less<void*>()(ptr, chunk + CHUNK_SIZE);
+}
+
+/**
+ *
+ */
+void EclipseAllocator::AddUsedBytes(int64 delta)
+{
+    uint64 used = _usedBytes.load(std::memory_order_relaxed) + delta;
+    _usedBytes.store(used, std::memory_order_relaxed);
+
+    if (used > _peakBytes.load(std::memory_order_relaxed))
+        _peakBytes.store(used, std::memory_order_relaxed);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_ALLOCATOR_HPP
+#define ECLIPSE_ALLOCATOR_HPP
+
+#include "EclipseIncludes.hpp"
+
+#include <array>
+
+// Per state lua_Alloc. Small Lua objects come from size class pools owned by the state,
+// so map threads do not contend on the global heap, and every byte is accounted to its state.
+class EclipseAllocator
+{
+    public:
+        explicit EclipseAllocator(uint64 memoryLimit = 0);
+        ~EclipseAllocator();
+
+        static void* Allocate(void* ud, void* ptr, std::size_t osize, std::size_t nsize);
+
+        uint64 GetUsedBytes() const { return _usedBytes.load(std::memory_order_relaxed); }
+        uint64 GetPeakBytes() const { return _peakBytes.load(std::memory_order_relaxed); }
+        uint64 GetReservedBytes() const { return _reservedBytes.load(std::memory_order_relaxed); }
+        uint64 GetFailedAllocations() const { return _failedAllocations.load(std::memory_order_relaxed); }
+
+        uint64 GetMemoryLimit() const { return _memoryLimit; }
+        void SetMemoryLimit(uint64 memoryLimit) { _memoryLimit = memoryLimit; }
+
+    private:
+        EclipseAllocator(const EclipseAllocator&) = delete;
+        EclipseAllocator& operator=(const EclipseAllocator&) = delete;
+
+        static constexpr std::size_t SIZE_CLASS_STEP = 16;
+        static constexpr std::size_t SIZE_CLASS_COUNT = 16;
+        static constexpr std::size_t SMALL_BLOCK_LIMIT = SIZE_CLASS_STEP * SIZE_CLASS_COUNT;
+        static constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+
+        struct FreeBlock
+        {
+            FreeBlock* next;
+        };
+
+        static std::size_t GetSizeClass(std::size_t size) { return (size - 1) / SIZE_CLASS_STEP; }
+
+        void* Reallocate(void* ptr, std::size_t oldSize, std::size_t newSize);
+        void* AllocateBlock(std::size_t size);
+        void ReleaseBlock(void* ptr, std::size_t size);
+        void* AllocateSmall(std::size_t sizeClass);
+        bool OwnsBlock(void* ptr) const;
+        void AddUsedBytes(int64 delta);
+
+        std::array<FreeBlock*, SIZE_CLASS_COUNT> _freeLists;
+        std::vector<void*> _chunks;     // sorted by address
+        char* _chunkCursor;
+        std::size_t _chunkRemaining;
+        std::size_t _keptLargeBlocks;   // heap blocks Lua now sees as small, left in place by a failed shrink
+
+        uint64 _memoryLimit;
+
+        // Written by the owning state only, read by anyone collecting statistics
+        std::atomic<uint64> _usedBytes;
+        std::atomic<uint64> _peakBytes;
+        std::atomic<uint64> _reservedBytes;
+        std::atomic<uint64> _failedAllocations;
+};
+
+#endif // ECLIPSE_ALLOCATOR_HPP
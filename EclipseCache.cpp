@@ -7,6 +7,214 @@
 #include "EclipseScriptLoader.hpp"
 #include "EclipseLogger.hpp"
 #include "EclipseCache.hpp"
+#include "EclipseHash.hpp"
+#include "EclipseMetrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#ifdef SOL_LUAJIT
+    #define ECLIPSE_LUA_VM_VERSION LUAJIT_VERSION
+#else
+    #define ECLIPSE_LUA_VM_VERSION LUA_RELEASE
+#endif
+
+namespace
+{
+    constexpr char const* CACHE_MANIFEST_FILE = "manifest.txt";
+    constexpr char const* CACHE_MANIFEST_HEADER = "ECLIPSE_BYTECODE_CACHE";
+    constexpr uint32 CACHE_MANIFEST_VERSION = 5;
+
+    std::string ToHex(uint64 value)
+    {
+        char buffer[17];
+        std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+        return buffer;
+    }
+
+    std::string JoinList(const std::vector<std::string>& values)
+    {
+        std::string list;
+        for (const std::string& value : values)
+        {
+            if (!list.empty())
+                list += ',';
+            list += value;
+        }
+
+        return list;
+    }
+
+    std::vector<std::string> SplitList(const std::string& list)
+    {
+        std::vector<std::string> values;
+        std::istringstream stream(list);
+        for (std::string value; std::getline(stream, value, ',');)
+            if (!value.empty())
+                values.push_back(std::move(value));
+
+        return values;
+    }
+
+    // Bytecode files are named after the script path so a renamed cache entry never collides
+    std::string GetBytecodeFileName(const std::string& filePath)
+    {
+        return ToHex(EclipseHash::Compute(filePath)) + ".luac";
+    }
+
+    std::string GetDebugInfoFileName(const std::string& bytecodeFile)
+    {
+        return bytecodeFile.substr(0, bytecodeFile.find_last_of('.')) + ".dbg";
+    }
+
+    // One `line\tname` per function, then one `@lineDefined\tlastLineDefined\tinstructionCount\thexDeltas` per line table
+    bool WriteDebugInfo(const std::string& path, const ScriptDebugInfo& debugInfo)
+    {
+        static constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+        std::ofstream stream(path, std::ios::trunc);
+        for (const ScriptFunctionInfo& function : debugInfo.functions)
+            stream << function.line << '\t' << function.name << '\n';
+
+        for (const ScriptLineInfo& lines : debugInfo.lines)
+        {
+            stream << '@' << lines.lineDefined << '\t' << lines.lastLineDefined << '\t' << lines.instructionCount << '\t';
+            for (char c : lines.lineDeltas)
+                stream << HEX_DIGITS[static_cast<uint8>(c) >> 4] << HEX_DIGITS[static_cast<uint8>(c) & 0xF];
+
+            stream << '\n';
+        }
+
+        return static_cast<bool>(stream);
+    }
+
+    bool ReadLineInfo(const std::string& line, ScriptLineInfo& lines)
+    {
+        std::istringstream stream(line.substr(1));
+        std::string hexDeltas;
+        if (!(stream >> lines.lineDefined >> lines.lastLineDefined >> lines.instructionCount))
+            return false;
+
+        stream >> hexDeltas;
+        if (hexDeltas.size() % 2)
+            return false;
+
+        lines.lineDeltas.reserve(hexDeltas.size() / 2);
+        for (std::size_t i = 0; i < hexDeltas.size(); i += 2)
+        {
+            char* end = nullptr;
+            std::string byte = hexDeltas.substr(i, 2);
+            lines.lineDeltas.push_back(static_cast<char>(std::strtoul(byte.c_str(), &end, 16)));
+            if (*end)
+                return false;
+        }
+
+        return true;
+    }
+
+    std::shared_ptr<const ScriptDebugInfo> ReadDebugInfo(const std::string& path)
+    {
+        std::ifstream stream(path);
+        if (!stream)
+            return nullptr;
+
+        auto debugInfo = std::make_shared<ScriptDebugInfo>();
+        for (std::string line; std::getline(stream, line);)
+        {
+            if (!line.empty() && line[0] == '@')
+            {
+                ScriptLineInfo lines;
+                if (ReadLineInfo(line, lines))
+                    debugInfo->lines.push_back(std::move(lines));
+
+                continue;
+            }
+
+            std::size_t separator = line.find('\t');
+            if (separator == std::string::npos)
+                continue;
+
+            int32 lineDefined = static_cast<int32>(std::strtol(line.c_str(), nullptr, 10));
+            debugInfo->functions.push_back({ lineDefined, line.substr(separator + 1) });
+        }
+
+        return debugInfo;
+    }
+}
+
+/**
+ * Exact match on the line the function was defined on, stripped frames only keep that one
+ */
+const ScriptFunctionInfo* ScriptDebugInfo::FindFunction(int32 lineDefined) const
+{
+    auto it = std::lower_bound(functions.begin(), functions.end(), lineDefined,
+        [](const ScriptFunctionInfo& function, int32 line) { return function.line < line; });
+
+    return it != functions.end() && it->line == lineDefined ? &*it : nullptr;
+}
+
+/**
+ *
+ */
+void ScriptLineInfo::AppendDelta(std::string& lineDeltas, int32 delta)
+{
+    uint32 value = (static_cast<uint32>(delta) << 1) ^ static_cast<uint32>(delta >> 31);
+    while (value >= 0x80)
+    {
+        lineDeltas.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+
+    lineDeltas.push_back(static_cast<char>(value));
+}
+
+/**
+ * Deltas are summed up to the instruction, only errors ever ask
+ */
+int32 ScriptLineInfo::GetLine(uint32 instruction) const
+{
+    if (instruction >= instructionCount)
+        return -1;
+
+    int32 line = lineDefined;
+    std::size_t offset = 0;
+    for (uint32 i = 0; i <= instruction; ++i)
+    {
+        uint32 value = 0;
+        for (uint32 shift = 0;; shift += 7)
+        {
+            if (offset >= lineDeltas.size() || shift > 28)
+                return -1;
+
+            uint8 byte = static_cast<uint8>(lineDeltas[offset++]);
+            value |= static_cast<uint32>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+
+        line += static_cast<int32>((value >> 1) ^ (~(value & 1) + 1));
+    }
+
+    return line;
+}
+
+/**
+ * Functions are told apart by their span and size, two identical ones on one line share the same lines anyway
+ */
+int32 ScriptDebugInfo::GetLine(int32 lineDefined, int32 lastLineDefined, uint32 instructionCount, uint32 instruction) const
+{
+    auto it = std::lower_bound(lines.begin(), lines.end(), std::make_pair(lineDefined, lastLineDefined),
+        [](const ScriptLineInfo& info, const std::pair<int32, int32>& span) { return std::make_pair(info.lineDefined, info.lastLineDefined) < span; });
+
+    for (; it != lines.end() && it->lineDefined == lineDefined && it->lastLineDefined == lastLineDefined; ++it)
+        if (it->instructionCount == instructionCount)
+            return it->GetLine(instruction);
+
+    return -1;
+}
 
 EclipseCache& EclipseCache::GetInstance()
 {
@@ -14,62 +222,341 @@ EclipseCache& EclipseCache::GetInstance()
     return instance;
 }
 
-std::time_t EclipseCache::GetFileWriteTime(const std::string& filePath)
+EclipseCache::EclipseCache() :
+_snapshot(std::make_shared<const CacheMap>()),
+_generation(0),
+_cacheState(SCRIPT_CACHE_NONE),
+_stripBytecode(false)
 {
-    struct stat fileInfo;
-    if (stat(filePath.c_str(), &fileInfo) == 0)
-        return fileInfo.st_mtime;
+}
+
+bool EclipseCache::GetFileInfo(const std::string& filePath, ScriptFileInfo& fileInfo)
+{
+    struct stat fileStat;
+    if (stat(filePath.c_str(), &fileStat) != 0)
+        return false;
 
-    return 0;
+    fileInfo.size = static_cast<uint64>(fileStat.st_size);
+#if defined(ECLIPSE_WINDOWS)
+    fileInfo.last_modified = static_cast<int64>(fileStat.st_mtime) * 1000000000;
+#elif defined(__APPLE__)
+    fileInfo.last_modified = static_cast<int64>(fileStat.st_mtimespec.tv_sec) * 1000000000 + fileStat.st_mtimespec.tv_nsec;
+#else
+    fileInfo.last_modified = static_cast<int64>(fileStat.st_mtim.tv_sec) * 1000000000 + fileStat.st_mtim.tv_nsec;
+#endif
+    return true;
 }
 
-std::time_t EclipseCache::GetCacheWriteTime(const std::string& filePath)
+bool EclipseCache::ReadScriptFile(const std::string& filePath, std::string& content)
 {
-    auto it = _cache.find(filePath);
-    if (it != _cache.end())
-        return it->second.last_modified;
+    std::ifstream file(filePath, std::ios::binary | std::ios::ate);
+    if (!file)
+        return false;
+
+    std::streamsize size = file.tellg();
+    if (size < 0)
+        return false;
 
-    return 0;
+    content.resize(static_cast<std::size_t>(size));
+    file.seekg(0);
+    return static_cast<bool>(file.read(content.data(), size));
 }
 
-bool EclipseCache::IsScriptModified(const std::string& filePath)
+bool EclipseCache::IsFileInfoCurrent(const std::string& filePath, const ScriptFileInfo& fileInfo) const
 {
-    std::time_t cacheTime = GetCacheWriteTime(filePath);
-    std::time_t fileTime = GetFileWriteTime(filePath);
+    CacheSnapshot snapshot = GetSnapshot();
+    auto it = snapshot->find(filePath);
+    return it != snapshot->end() && it->second.file_info.HasSameMetadata(fileInfo);
+}
 
-    return fileTime > cacheTime;
+bool EclipseCache::IsContentCached(const std::string& filePath, uint64 contentHash) const
+{
+    CacheSnapshot snapshot = GetSnapshot();
+    auto it = snapshot->find(filePath);
+    return it != snapshot->end() && !it->second.bytecode.IsEmpty() && it->second.file_info.content_hash == contentHash;
 }
 
-std::optional<sol::bytecode> EclipseCache::GetBytecode(const std::string& filePath)
+bool EclipseCache::IsScriptModified(const std::string& filePath) const
 {
-    auto it = _cache.find(filePath);
-    if(it == _cache.end())
-        return std::nullopt;
+    ScriptFileInfo fileInfo;
+    if (!GetFileInfo(filePath, fileInfo))
+        return true;
+
+    // Metadata is only a cheap pre-check, touched files are confirmed against their content
+    if (IsFileInfoCurrent(filePath, fileInfo))
+        return false;
 
-    CacheEntry cacheEntry = it->second;
+    std::string content;
+    if (!ReadScriptFile(filePath, content))
+        return true;
+
+    return !IsContentCached(filePath, EclipseHash::Compute(content));
+}
 
-    if (IsScriptModified(filePath))
+// Read path only, stale entries are replaced by the loader when scripts are reloaded
+ScriptBytecode EclipseCache::GetBytecode(const std::string& filePath) const
+{
+    CacheSnapshot snapshot = GetSnapshot();
+    auto it = snapshot->find(filePath);
+    if(it == snapshot->end() || it->second.bytecode.IsEmpty())
     {
-        InvalidateScript(filePath);
-        return std::nullopt;
+        EclipseMetrics::GetInstance().Increment(METRIC_CACHE_MISSES);
+        return {};
     }
 
-    return cacheEntry.bytecode;
+    EclipseMetrics::GetInstance().Increment(METRIC_CACHE_HITS);
+    return it->second.bytecode;
+}
+
+std::vector<std::string> EclipseCache::GetDependencies(const std::string& filePath) const
+{
+    CacheSnapshot snapshot = GetSnapshot();
+    auto it = snapshot->find(filePath);
+    if(it == snapshot->end())
+        return {};
+
+    return it->second.dependencies;
+}
+
+std::shared_ptr<const ScriptDebugInfo> EclipseCache::GetDebugInfo(const std::string& filePath) const
+{
+    CacheSnapshot snapshot = GetSnapshot();
+    auto it = snapshot->find(filePath);
+    if(it == snapshot->end())
+        return nullptr;
+
+    return it->second.debug_info;
+}
+
+void EclipseCache::SetStripBytecode(bool stripBytecode)
+{
+    if (_stripBytecode.exchange(stripBytecode) != stripBytecode && !IsEmpty())
+        InvalidateAllScripts();
 }
 
 void EclipseCache::InvalidateScript(const std::string& filePath)
 {
-    _cache.erase(filePath);
+    Update([&filePath](CacheMap& cache)
+    {
+        if (cache.erase(filePath))
+            EclipseMetrics::GetInstance().Increment(METRIC_CACHE_INVALIDATIONS);
+    });
     ECLIPSE_LOG_INFO("[Eclipse]: Invalidated cache for script: {}", filePath);
 }
 
-void EclipseCache::StoreByteCode(const std::string& filePath, sol::bytecode bytecode)
+void EclipseCache::StoreByteCode(const std::string& filePath, sol::bytecode bytecode, const ScriptFileInfo& fileInfo)
 {
-    std::time_t modTime = GetFileWriteTime(filePath);
-    _cache[filePath] = CacheEntry(std::move(bytecode), modTime);
+    ScriptBytecode scriptBytecode = ScriptBytecode::Create(std::move(bytecode));
+    Update([&](CacheMap& cache) { cache[filePath] = CacheEntry(std::move(scriptBytecode), fileInfo); });
+}
+
+void EclipseCache::UpdateFileInfo(const std::string& filePath, const ScriptFileInfo& fileInfo)
+{
+    Update([&](CacheMap& cache)
+    {
+        auto it = cache.find(filePath);
+        if (it != cache.end())
+            it->second.file_info = fileInfo;
+    });
 }
 
 void EclipseCache::InvalidateAllScripts()
 {
-    _cache.clear();
+    Update([](CacheMap& cache)
+    {
+        EclipseMetrics::GetInstance().Increment(METRIC_CACHE_INVALIDATIONS, cache.size());
+        cache.clear();
+    });
+}
+
+/**
+ *
+ */
+std::string EclipseCache::GetLuaVMVersion()
+{
+    return std::string(ECLIPSE_LUA_VM_VERSION) + "/" + std::to_string(sizeof(void*) * 8);
+}
+
+/**
+ *
+ */
+bool EclipseCache::LoadFromDisk(const std::string& cachePath)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    boost::filesystem::path cacheDir(cachePath);
+    std::ifstream manifest((cacheDir / CACHE_MANIFEST_FILE).string());
+    if (!manifest)
+    {
+        ECLIPSE_LOG_DEBUG("[Eclipse]: No bytecode cache manifest found in `{}`", cachePath);
+        return false;
+    }
+
+    std::string line;
+    if (!std::getline(manifest, line))
+        return false;
+
+    std::istringstream header(line);
+    std::string magic, vmVersion;
+    uint32 version = 0, stripped = 0;
+    std::getline(header, magic, '\t');
+    header >> version;
+    header.ignore(1);
+    std::getline(header, vmVersion, '\t');
+    header >> stripped;
+
+    if (magic != CACHE_MANIFEST_HEADER || version != CACHE_MANIFEST_VERSION || vmVersion != GetLuaVMVersion() || (stripped != 0) != IsStripBytecode())
+    {
+        ECLIPSE_LOG_INFO("[Eclipse]: Bytecode cache in `{}` was built for another Lua VM, format or strip mode, ignoring it", cachePath);
+        return false;
+    }
+
+    CacheMap loaded;
+    while (std::getline(manifest, line))
+    {
+        std::istringstream entryLine(line);
+        std::string size, modTime, hash, dependencies, bytecodeFile, filePath;
+        if (!std::getline(entryLine, size, '\t') || !std::getline(entryLine, modTime, '\t') ||
+            !std::getline(entryLine, hash, '\t') || !std::getline(entryLine, dependencies, '\t') ||
+            !std::getline(entryLine, bytecodeFile, '\t') || !std::getline(entryLine, filePath))
+            continue;
+
+        std::ifstream bytecodeStream((cacheDir / bytecodeFile).string(), std::ios::binary | std::ios::ate);
+        if (!bytecodeStream)
+            continue;
+
+        std::streamsize bytecodeSize = bytecodeStream.tellg();
+        if (bytecodeSize <= 0)
+            continue;
+
+        sol::bytecode bytecode;
+        bytecode.resize(static_cast<std::size_t>(bytecodeSize));
+        bytecodeStream.seekg(0);
+        if (!bytecodeStream.read(reinterpret_cast<char*>(bytecode.data()), bytecodeSize))
+            continue;
+
+        CacheEntry entry;
+        entry.bytecode = ScriptBytecode::Create(std::move(bytecode));
+
+        try
+        {
+            entry.file_info.size = std::stoull(size);
+            entry.file_info.last_modified = std::stoll(modTime);
+            entry.file_info.content_hash = std::stoull(hash, nullptr, 16);
+        }
+        catch (const std::exception&)
+        {
+            continue;
+        }
+
+        entry.dependencies = SplitList(dependencies);
+
+        if (IsStripBytecode())
+            entry.debug_info = ReadDebugInfo((cacheDir / GetDebugInfoFileName(bytecodeFile)).string());
+
+        entry.persisted = true;
+        loaded[filePath] = std::move(entry);
+    }
+
+    // Entries compiled in this process are newer than anything found on disk, merge leaves them in loaded
+    std::size_t readCount = loaded.size();
+    Update([&loaded](CacheMap& cache) { cache.merge(loaded); });
+    std::size_t acceptedCount = readCount - loaded.size();
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
+    ECLIPSE_LOG_INFO("[Eclipse]: Loaded {} cached bytecode entries from `{}` in {} µs", acceptedCount, cachePath, static_cast<uint32>(duration));
+    return true;
+}
+
+/**
+ *
+ */
+bool EclipseCache::SaveToDisk(const std::string& cachePath)
+{
+    try
+    {
+        boost::filesystem::path cacheDir(cachePath);
+        boost::filesystem::create_directories(cacheDir);
+
+        boost::filesystem::path manifestPath = cacheDir / CACHE_MANIFEST_FILE;
+        boost::filesystem::path tempManifestPath = cacheDir / (std::string(CACHE_MANIFEST_FILE) + ".tmp");
+
+        std::ofstream manifest(tempManifestPath.string(), std::ios::trunc);
+        if (!manifest)
+        {
+            ECLIPSE_LOG_ERROR("[Eclipse]: Unable to write bytecode cache manifest in `{}`", cachePath);
+            return false;
+        }
+
+        manifest << CACHE_MANIFEST_HEADER << '\t' << CACHE_MANIFEST_VERSION << '\t' << GetLuaVMVersion() << '\t' << (IsStripBytecode() ? 1 : 0) << '\n';
+
+        std::unordered_set<std::string> bytecodeFiles;
+        std::unordered_map<std::string, const char*> persisted;
+
+        // Written from a snapshot, publishers are not held up by the disk
+        CacheSnapshot snapshot = GetSnapshot();
+        for (const auto& [filePath, entry] : *snapshot)
+        {
+            if (entry.bytecode.IsEmpty() || !boost::filesystem::exists(filePath))
+                continue;
+
+            std::string bytecodeFile = GetBytecodeFileName(filePath);
+            std::string debugInfoFile = GetDebugInfoFileName(bytecodeFile);
+            if (!entry.persisted)
+            {
+                std::ofstream bytecodeStream((cacheDir / bytecodeFile).string(), std::ios::binary | std::ios::trunc);
+                if (!bytecodeStream.write(entry.bytecode.GetData(), entry.bytecode.GetSize()))
+                {
+                    ECLIPSE_LOG_ERROR("[Eclipse]: Unable to write cached bytecode for `{}`", filePath);
+                    continue;
+                }
+
+                if (entry.debug_info && !WriteDebugInfo((cacheDir / debugInfoFile).string(), *entry.debug_info))
+                    ECLIPSE_LOG_ERROR("[Eclipse]: Unable to write debug info for `{}`", filePath);
+
+                persisted.emplace(filePath, entry.bytecode.GetData());
+            }
+
+            manifest << entry.file_info.size << '\t' << entry.file_info.last_modified << '\t' << ToHex(entry.file_info.content_hash) << '\t'
+                     << JoinList(entry.dependencies) << '\t' << bytecodeFile << '\t' << filePath << '\n';
+            bytecodeFiles.insert(std::move(bytecodeFile));
+            if (entry.debug_info)
+                bytecodeFiles.insert(std::move(debugInfoFile));
+        }
+
+        // Only entries still holding the bytecode that was written are flagged, recompiled ones are saved next time
+        if (!persisted.empty())
+        {
+            Update([&persisted](CacheMap& cache)
+            {
+                for (const auto& [filePath, bytecode] : persisted)
+                {
+                    auto it = cache.find(filePath);
+                    if (it != cache.end() && it->second.bytecode.GetData() == bytecode)
+                        it->second.persisted = true;
+                }
+            });
+        }
+
+        manifest.close();
+        boost::filesystem::rename(tempManifestPath, manifestPath);
+
+        // Drop bytecode and debug info of scripts that no longer exist
+        for (boost::filesystem::directory_iterator it(cacheDir), end; it != end; ++it)
+        {
+            std::string extension = it->path().extension().string();
+            if ((extension == ".luac" || extension == ".dbg") && !bytecodeFiles.count(it->path().filename().string()))
+                boost::filesystem::remove(it->path());
+        }
+
+        ECLIPSE_LOG_DEBUG("[Eclipse]: Saved bytecode cache to `{}` ({} files, {} written)", cachePath, bytecodeFiles.size(), persisted.size());
+        return true;
+    }
+    catch (const std::exception& e)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Exception when saving bytecode cache to `{}`: {}", cachePath, e.what());
+    }
+
+    return false;
 }
\ No newline at end of file
@@ -9,14 +9,89 @@
 
 #include "EclipseIncludes.hpp"
 
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct ScriptFileInfo
+{
+    uint64 size;
+    int64 last_modified; // nanoseconds
+    uint64 content_hash;
+
+    ScriptFileInfo() : size(0), last_modified(0), content_hash(0) {}
+
+    bool HasSameMetadata(const ScriptFileInfo& other) const { return size == other.size && last_modified == other.last_modified; }
+};
+
+// Immutable, reference counted view on compiled bytecode, every state loading a script shares the same buffer
+class ScriptBytecode
+{
+    public:
+        ScriptBytecode() = default;
+        ScriptBytecode(std::shared_ptr<const void> owner, std::string_view data)
+            : _owner(std::move(owner)), _data(data) {}
+
+        static ScriptBytecode Create(sol::bytecode&& bytecode)
+        {
+            auto owner = std::make_shared<const sol::bytecode>(std::move(bytecode));
+            std::string_view data(reinterpret_cast<const char*>(owner->data()), owner->size());
+            return ScriptBytecode(std::move(owner), data);
+        }
+
+        std::string_view GetView() const { return _data; }
+        const char* GetData() const { return _data.data(); }
+        std::size_t GetSize() const { return _data.size(); }
+        bool IsEmpty() const { return _data.empty(); }
+
+        explicit operator bool() const { return !_data.empty(); }
+
+    private:
+        std::shared_ptr<const void> _owner;
+        std::string_view _data;
+};
+
+struct ScriptFunctionInfo
+{
+    int32 line;
+    std::string name;
+};
+
+// Line of every instruction of one function, what stripping drops from its bytecode
+struct ScriptLineInfo
+{
+    int32 lineDefined;
+    int32 lastLineDefined;
+    uint32 instructionCount;
+    std::string lineDeltas; // zigzag varint per instruction, from the line of the one before, lineDefined for the first
+
+    static void AppendDelta(std::string& lineDeltas, int32 delta);
+    int32 GetLine(uint32 instruction) const;
+};
+
+// Debug info kept out of stripped bytecode, function definitions and line tables sorted by line
+struct ScriptDebugInfo
+{
+    std::vector<ScriptFunctionInfo> functions;
+    std::vector<ScriptLineInfo> lines;
+
+    const ScriptFunctionInfo* FindFunction(int32 lineDefined) const;
+
+    // -1 when no function of that span and size is known
+    int32 GetLine(int32 lineDefined, int32 lastLineDefined, uint32 instructionCount, uint32 instruction) const;
+};
+
 struct CacheEntry
 {
-    sol::bytecode bytecode;
-    std::time_t last_modified;
+    ScriptBytecode bytecode;
+    ScriptFileInfo file_info;
+    std::vector<std::string> dependencies; // module names found by static require analysis
+    std::shared_ptr<const ScriptDebugInfo> debug_info; // only set for stripped bytecode
+    bool persisted;
 
-    CacheEntry() : last_modified(0) {}
-    CacheEntry(const sol::bytecode& code, std::time_t modTime)
-        : bytecode(code), last_modified(modTime) {}
+    CacheEntry() : persisted(false) {}
+    CacheEntry(ScriptBytecode code, const ScriptFileInfo& fileInfo, std::vector<std::string> requiredModules = {})
+        : bytecode(std::move(code)), file_info(fileInfo), dependencies(std::move(requiredModules)), persisted(false) {}
 };
 
 enum EclipseScriptCacheState
@@ -30,37 +105,72 @@ enum EclipseScriptCacheState
 class EclipseCache
 {
     public:
+        typedef std::unordered_map<std::string, CacheEntry> CacheMap;
+        typedef std::shared_ptr<const CacheMap> CacheSnapshot;
+
         static EclipseCache& GetInstance();
 
-        std::optional<sol::bytecode> GetBytecode(const std::string& filePath);
-        void StoreByteCode(const std::string& filePath, sol::bytecode bytecode);
+        // Readers never lock, they work on the snapshot published by the last writer
+        CacheSnapshot GetSnapshot() const { return _snapshot.load(std::memory_order_acquire); }
+        uint32 GetGeneration() const { return _generation.load(std::memory_order_acquire); }
+
+        ScriptBytecode GetBytecode(const std::string& filePath) const;
+        std::vector<std::string> GetDependencies(const std::string& filePath) const;
+        std::shared_ptr<const ScriptDebugInfo> GetDebugInfo(const std::string& filePath) const;
+        void StoreByteCode(const std::string& filePath, sol::bytecode bytecode, const ScriptFileInfo& fileInfo);
+        void UpdateFileInfo(const std::string& filePath, const ScriptFileInfo& fileInfo);
 
-        CacheEntry& GetCacheEntry(const std::string& filePath) { return _cache[filePath]; }
+        // Writers build the next generation from a copy of the current one and publish it at once
+        template<typename Fn>
+        void Update(Fn&& fn)
+        {
+            std::lock_guard<std::mutex> guard(_writeLock);
+            auto next = std::make_shared<CacheMap>(*GetSnapshot());
+            fn(*next);
+            _snapshot.store(std::move(next), std::memory_order_release);
+            _generation.fetch_add(1, std::memory_order_acq_rel);
+        }
+
+        bool IsFileInfoCurrent(const std::string& filePath, const ScriptFileInfo& fileInfo) const;
+        bool IsContentCached(const std::string& filePath, uint64 contentHash) const;
+        bool IsScriptModified(const std::string& filePath) const;
 
-        std::time_t GetFileWriteTime(const std::string& filePath);
-        std::time_t GetCacheWriteTime(const std::string& filePath);
-        bool IsScriptModified(const std::string& filePath);
+        static bool GetFileInfo(const std::string& filePath, ScriptFileInfo& fileInfo);
+        static bool ReadScriptFile(const std::string& filePath, std::string& content);
+        static std::string GetLuaVMVersion();
 
-        bool IsInCache(const std::string& filePath) {
-            auto it = _cache.find(filePath);
-            return it != _cache.end() && !it->second.bytecode.as_string_view().empty();
+        bool LoadFromDisk(const std::string& cachePath);
+        bool SaveToDisk(const std::string& cachePath);
+        bool IsEmpty() const { return GetSnapshot()->empty(); }
+
+        bool IsInCache(const std::string& filePath) const {
+            CacheSnapshot snapshot = GetSnapshot();
+            auto it = snapshot->find(filePath);
+            return it != snapshot->end() && !it->second.bytecode.IsEmpty();
         }
 
         void InvalidateScript(const std::string& filePath);
         void InvalidateAllScripts();
 
+        // Switching modes drops every entry, bytecode of both modes never coexists
+        bool IsStripBytecode() const { return _stripBytecode; }
+        void SetStripBytecode(bool stripBytecode);
+
         uint8 GetCacheState() { return _cacheState; }
         void SetCacheState(uint8 cacheState) { _cacheState = cacheState; }
 
     private:
-        EclipseCache() = default;
+        EclipseCache();
         ~EclipseCache() = default;
         EclipseCache(const EclipseCache&) = delete;
         EclipseCache& operator=(const EclipseCache&) = delete;
 
     private:
-        std::unordered_map<std::string, CacheEntry> _cache;
+        std::atomic<CacheSnapshot> _snapshot;
+        std::atomic<uint32> _generation;
+        std::mutex _writeLock;
         std::atomic<uint8> _cacheState;
+        std::atomic<bool> _stripBytecode;
 };
 
 #endif //ECLIPSE_LUA_CACHE_HPP
\ No newline at end of file
@@ -6,28 +6,321 @@
 
 #include "EclipseCompiler.hpp"
 #include "EclipseLogger.hpp"
+#include "EclipseMetrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+// Line info is read out of the Proto before stripping and the instruction of a frame out of its CallInfo,
+// neither is reachable through the Lua API. Without these headers stripping stays off.
+#if !defined(SOL_LUAJIT) && LUA_VERSION_NUM == 504 && __has_include(<ldebug.h>)
+    #define ECLIPSE_LUA_INTERNALS
+extern "C"
+{
+    #include <ldebug.h>
+}
+#endif
+
+namespace
+{
+    constexpr char const* MOONSCRIPT_MODULE = "moonscript.base";
+
+    std::atomic<bool> stripFallbackLogged = false;
+
+    bool IsIdentifierChar(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool IsNameChar(char c)
+    {
+        return IsIdentifierChar(c) || c == '.' || c == ':';
+    }
+
+    // Walks Lua (or MoonScript) source one identifier at a time, comments and strings are skipped
+    class SourceScanner
+    {
+        public:
+            explicit SourceScanner(std::string_view source) : _source(source), _pos(0), _linePos(0), _line(1) {}
+
+            bool NextIdentifier(std::string_view& identifier, std::size_t& start)
+            {
+                while (_pos < _source.size())
+                {
+                    char c = _source[_pos];
+
+                    if (c == '-' && _pos + 1 < _source.size() && _source[_pos + 1] == '-')
+                    {
+                        std::size_t level = GetLongBracketLevel(_pos + 2);
+                        if (level != std::string_view::npos)
+                            SkipLongBracket(_pos + 2, level);
+                        else
+                        {
+                            _pos = _source.find('\n', _pos);
+                            _pos = _pos == std::string_view::npos ? _source.size() : _pos + 1;
+                        }
+                        continue;
+                    }
+
+                    if (c == '"' || c == '\'')
+                    {
+                        for (++_pos; _pos < _source.size() && _source[_pos] != c; ++_pos)
+                            if (_source[_pos] == '\\')
+                                ++_pos;
+
+                        ++_pos;
+                        continue;
+                    }
+
+                    if (c == '[')
+                    {
+                        std::size_t level = GetLongBracketLevel(_pos);
+                        if (level != std::string_view::npos)
+                            SkipLongBracket(_pos, level);
+                        else
+                            ++_pos;
+                        continue;
+                    }
+
+                    if (!IsIdentifierChar(c))
+                    {
+                        ++_pos;
+                        continue;
+                    }
+
+                    start = _pos;
+                    while (_pos < _source.size() && IsIdentifierChar(_source[_pos]))
+                        ++_pos;
+
+                    identifier = _source.substr(start, _pos - start);
+                    return true;
+                }
+
+                return false;
+            }
+
+            // Literal argument of a call, `"a"` or `('a')`, the scanner moves past it
+            bool ReadStringArgument(std::string& value)
+            {
+                std::size_t pos = SkipWhitespace(_pos);
+                if (pos < _source.size() && _source[pos] == '(')
+                    pos = SkipWhitespace(pos + 1);
+
+                if (pos >= _source.size() || (_source[pos] != '"' && _source[pos] != '\''))
+                    return false;
+
+                std::size_t end = _source.find(_source[pos], pos + 1);
+                if (end == std::string_view::npos)
+                    return false;
+
+                value = _source.substr(pos + 1, end - pos - 1);
+                _pos = end + 1;
+                return value.find_first_of("\\\n") == std::string::npos;
+            }
+
+            // Name following the current position, `a.b:c` for `function a.b:c()`
+            std::string_view PeekName() const
+            {
+                std::size_t pos = SkipWhitespace(_pos);
+                std::size_t end = pos;
+                while (end < _source.size() && IsNameChar(_source[end]))
+                    ++end;
+
+                return _source.substr(pos, end - pos);
+            }
+
+            char GetPreviousChar(std::size_t start) const
+            {
+                std::size_t pos = SkipWhitespaceBackward(start);
+                return pos > 0 ? _source[pos - 1] : '\0';
+            }
+
+            std::string_view GetPreviousName(std::size_t start) const
+            {
+                std::size_t end = SkipWhitespaceBackward(start);
+                std::size_t pos = end;
+                while (pos > 0 && IsNameChar(_source[pos - 1]))
+                    --pos;
+
+                return _source.substr(pos, end - pos);
+            }
+
+            // `name = function`, comparisons are not assignments
+            std::string_view GetAssignedName(std::size_t start) const
+            {
+                std::size_t pos = SkipWhitespaceBackward(start);
+                if (pos < 2 || _source[pos - 1] != '=' || std::string_view("=~<>").find(_source[pos - 2]) != std::string_view::npos)
+                    return {};
+
+                return GetPreviousName(pos - 1);
+            }
+
+            // Positions are expected in increasing order
+            int32 GetLine(std::size_t pos)
+            {
+                for (; _linePos < pos && _linePos < _source.size(); ++_linePos)
+                    if (_source[_linePos] == '\n')
+                        ++_line;
+
+                return _line;
+            }
+
+        private:
+            // Level of the long bracket opening at `pos` ([[, [=[, ...), npos when there is none
+            std::size_t GetLongBracketLevel(std::size_t pos) const
+            {
+                if (pos >= _source.size() || _source[pos] != '[')
+                    return std::string_view::npos;
+
+                std::size_t level = 0;
+                while (pos + 1 + level < _source.size() && _source[pos + 1 + level] == '=')
+                    ++level;
+
+                return pos + 1 + level < _source.size() && _source[pos + 1 + level] == '[' ? level : std::string_view::npos;
+            }
+
+            void SkipLongBracket(std::size_t pos, std::size_t level)
+            {
+                std::string closing = "]" + std::string(level, '=') + "]";
+                std::size_t end = _source.find(closing, pos + level + 2);
+                _pos = end == std::string_view::npos ? _source.size() : end + closing.size();
+            }
+
+            std::size_t SkipWhitespace(std::size_t pos) const
+            {
+                while (pos < _source.size() && std::isspace(static_cast<unsigned char>(_source[pos])))
+                    ++pos;
+
+                return pos;
+            }
+
+            std::size_t SkipWhitespaceBackward(std::size_t pos) const
+            {
+                while (pos > 0 && std::isspace(static_cast<unsigned char>(_source[pos - 1])))
+                    --pos;
+
+                return pos;
+            }
+
+            std::string_view _source;
+            std::size_t _pos;
+            std::size_t _linePos;
+            int32 _line;
+    };
+
+#ifdef ECLIPSE_LUA_INTERNALS
+    // Lua 5.4 drops the source of stripped chunks and nested functions inherit the one of the main
+    // function, writing it back there keeps file names in error messages and stack walks.
+    bool SetChunkSource(sol::bytecode& bytecode, const std::string& chunkName)
+    {
+        constexpr std::size_t SIGNATURE_SIZE = sizeof(LUA_SIGNATURE) - 1;
+        // Signature, version, format, LUAC_DATA, instruction/integer/number sizes, LUAC_INT, LUAC_NUM
+        // and the upvalue count of the main function
+        constexpr std::size_t SOURCE_OFFSET = SIGNATURE_SIZE + 2 + 6 + 3 + sizeof(lua_Integer) + sizeof(lua_Number) + 1;
+        constexpr uint8 EMPTY_STRING = 0x80;
+
+        if (bytecode.size() <= SOURCE_OFFSET || std::memcmp(bytecode.data(), LUA_SIGNATURE, SIGNATURE_SIZE) != 0 ||
+            std::to_integer<uint8>(bytecode[SIGNATURE_SIZE]) != 0x54 || std::to_integer<uint8>(bytecode[SOURCE_OFFSET]) != EMPTY_STRING)
+            return false;
+
+        // String sizes are stored + 1, in 7 bit groups, most significant first, the last one flagged with 0x80
+        std::vector<std::byte> source;
+        for (std::size_t size = chunkName.size() + 1; size; size >>= 7)
+            source.insert(source.begin(), static_cast<std::byte>(size & 0x7f));
+
+        source.back() |= std::byte{ EMPTY_STRING };
+        for (char c : chunkName)
+            source.push_back(static_cast<std::byte>(c));
+
+        bytecode.erase(bytecode.begin() + SOURCE_OFFSET);
+        bytecode.insert(bytecode.begin() + SOURCE_OFFSET, source.begin(), source.end());
+        return true;
+    }
+
+    // Same walk as luaG_getfuncline: a delta per instruction, absolute lines where a delta does not fit
+    void CollectLineInfo(const Proto* proto, std::vector<ScriptLineInfo>& lines)
+    {
+        if (proto->lineinfo)
+        {
+            ScriptLineInfo info{ proto->linedefined, proto->lastlinedefined, static_cast<uint32>(proto->sizecode), {} };
+            int32 line = proto->linedefined;
+            int absIndex = 0;
+            for (int pc = 0; pc < proto->sizecode && pc < proto->sizelineinfo; ++pc)
+            {
+                int32 next = line + proto->lineinfo[pc];
+                if (proto->lineinfo[pc] == ABSLINEINFO)
+                {
+                    while (absIndex < proto->sizeabslineinfo && proto->abslineinfo[absIndex].pc < pc)
+                        ++absIndex;
+
+                    next = absIndex < proto->sizeabslineinfo && proto->abslineinfo[absIndex].pc == pc ? proto->abslineinfo[absIndex].line : line;
+                }
+
+                ScriptLineInfo::AppendDelta(info.lineDeltas, next - line);
+                line = next;
+            }
+
+            lines.push_back(std::move(info));
+        }
+
+        for (int i = 0; i < proto->sizep; ++i)
+            CollectLineInfo(proto->p[i], lines);
+    }
+#endif
+}
 
 std::optional<sol::bytecode> EclipseCompiler::CompileLuaToByteCode(sol::state& compilerState, const std::string& filePath)
 {
-    try
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file)
     {
-        auto startTime = std::chrono::high_resolution_clock::now();
+        ECLIPSE_LOG_ERROR("[Eclipse]: Error loading script `{}`: cannot open file", filePath);
+        return std::nullopt;
+    }
+
+    std::ostringstream source;
+    source << file.rdbuf();
+    return CompileLuaToByteCode(compilerState, filePath, source.str());
+}
+
+std::optional<sol::bytecode> EclipseCompiler::CompileLuaToByteCode(sol::state& compilerState, const std::string& filePath, std::string_view source, std::shared_ptr<const ScriptDebugInfo>* strippedDebugInfo)
+{
+    EclipseMetrics& metrics = EclipseMetrics::GetInstance();
+    EclipseMetricTimer compileTimer(METRIC_COMPILE_TIME);
 
-        sol::load_result loaded_script = compilerState.load_file(filePath);
+    try
+    {
+        // Same chunk name load_file would use, so error locations keep pointing at the script
+        std::string chunkName = "@" + filePath;
+        sol::load_result loaded_script = compilerState.load(source, chunkName, sol::load_mode::text);
 
         if (!loaded_script.valid())
         {
             sol::error err = loaded_script;
             ECLIPSE_LOG_ERROR("[Eclipse]: Error loading script `{}`: {}", filePath, err.what());
+            metrics.Increment(METRIC_COMPILE_ERRORS);
             return std::nullopt;
         }
 
         sol::protected_function target = loaded_script.get<sol::protected_function>();
-        sol::bytecode bytecode = target.dump();
+        sol::bytecode bytecode;
+        ScriptDebugInfo debugInfo;
+        bool stripped = strippedDebugInfo && DumpStrippedByteCode(compilerState, target, chunkName, bytecode, debugInfo);
+        if (!stripped)
+            bytecode = target.dump();
 
-        auto endTime = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
-        ECLIPSE_LOG_DEBUG("[Eclipse]: Successfully compiled `{}` to bytecode in {} µs", filePath, static_cast<uint32>(duration));
+        metrics.Increment(METRIC_SCRIPTS_COMPILED);
+        ECLIPSE_LOG_DEBUG("[Eclipse]: Successfully compiled `{}` to bytecode in {} µs", filePath, static_cast<uint32>(compileTimer.GetElapsed()));
+
+        if (stripped)
+        {
+            debugInfo.functions = GetDebugInfo(source).functions;
+            *strippedDebugInfo = std::make_shared<const ScriptDebugInfo>(std::move(debugInfo));
+        }
 
         return bytecode;
     }
@@ -43,5 +336,239 @@ std::optional<sol::bytecode> EclipseCompiler::CompileLuaToByteCode(sol::state& c
     {
         ECLIPSE_LOG_ERROR("[Eclipse]: Unknown error compiling `{}`", filePath);
     }
+
+    metrics.Increment(METRIC_COMPILE_ERRORS);
     return std::nullopt;
-}
\ No newline at end of file
+}
+
+/**
+ * Line info, local and upvalue names are dropped, the chunk keeps its file name and the lines of every
+ * function go to `debugInfo`. False when the VM cannot load it back that way, the caller keeps the full dump then.
+ */
+bool EclipseCompiler::DumpStrippedByteCode(sol::state& compilerState, const sol::protected_function& target, const std::string& chunkName, sol::bytecode& bytecode, ScriptDebugInfo& debugInfo)
+{
+#ifdef ECLIPSE_LUA_INTERNALS
+    lua_State* L = compilerState.lua_state();
+    target.push(L);
+    const LClosure* closure = lua_type(L, -1) == LUA_TFUNCTION && !lua_iscfunction(L, -1) ? static_cast<const LClosure*>(lua_topointer(L, -1)) : nullptr;
+    lua_pop(L, 1);
+
+    debugInfo.lines.clear();
+    if (closure)
+        CollectLineInfo(closure->p, debugInfo.lines);
+
+    std::stable_sort(debugInfo.lines.begin(), debugInfo.lines.end(), [](const ScriptLineInfo& left, const ScriptLineInfo& right) {
+        return std::make_pair(left.lineDefined, left.lastLineDefined) < std::make_pair(right.lineDefined, right.lastLineDefined);
+    });
+
+    if (closure)
+    {
+        bytecode.clear();
+        target.dump(&sol::basic_insert_dump_writer<sol::bytecode>, &bytecode, true, sol::dump_throw_on_error);
+
+        if (SetChunkSource(bytecode, chunkName) &&
+            compilerState.load(std::string_view(reinterpret_cast<const char*>(bytecode.data()), bytecode.size()), chunkName, sol::load_mode::binary).valid())
+            return true;
+    }
+#else
+    (void)compilerState;
+    (void)target;
+    (void)chunkName;
+    (void)bytecode;
+    (void)debugInfo;
+#endif
+
+    if (!stripFallbackLogged.exchange(true))
+        ECLIPSE_LOG_WARN("[Eclipse]: Stripped bytecode is not supported by this Lua VM, scripts keep their debug info");
+
+    return false;
+}
+
+/**
+ * sol passes the strip flag of dump to Lua 5.4 only, LuaJIT and older VMs always write their debug info.
+ * The lines are only recoverable with the internal headers of the VM at hand.
+ */
+bool EclipseCompiler::CanStripByteCode()
+{
+#ifdef ECLIPSE_LUA_INTERNALS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * MoonScript is loaded once per compiler state through require, it needs moonscript and lpeg
+ * reachable from the configured require paths
+ */
+std::unique_ptr<sol::state> EclipseCompiler::CreateMoonCompilerState(const std::string& requirePath, const std::string& requireCPath)
+{
+    try
+    {
+        auto moonState = std::make_unique<sol::state>();
+        moonState->open_libraries(
+            sol::lib::base,
+            sol::lib::package,
+            sol::lib::coroutine,
+            sol::lib::string,
+            sol::lib::os,
+            sol::lib::math,
+            sol::lib::table,
+            sol::lib::debug,
+            sol::lib::io
+        );
+
+        (*moonState)["package"]["path"] = requirePath;
+        (*moonState)["package"]["cpath"] = requireCPath;
+
+        sol::protected_function require = (*moonState)["require"];
+        sol::protected_function_result result = require(MOONSCRIPT_MODULE);
+        if (!result.valid())
+        {
+            sol::error err = result;
+            ECLIPSE_LOG_ERROR("[Eclipse]: MoonScript compiler unavailable, `.moon` scripts will not be loaded: {}", err.what());
+            return nullptr;
+        }
+
+        return moonState;
+    }
+    catch (const std::exception& e)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Exception creating MoonScript compiler state: {}", e.what());
+    }
+
+    return nullptr;
+}
+
+std::optional<sol::bytecode> EclipseCompiler::CompileMoonToByteCode(sol::state& moonState, const std::string& filePath)
+{
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Error loading script `{}`: cannot open file", filePath);
+        return std::nullopt;
+    }
+
+    std::ostringstream source;
+    source << file.rdbuf();
+    return CompileMoonToByteCode(moonState, filePath, source.str());
+}
+
+std::optional<sol::bytecode> EclipseCompiler::CompileMoonToByteCode(sol::state& moonState, const std::string& filePath, std::string_view source)
+{
+    try
+    {
+        sol::protected_function toLua = moonState["package"]["loaded"][MOONSCRIPT_MODULE]["to_lua"];
+        sol::protected_function_result transpiled = toLua(source);
+        if (!transpiled.valid())
+        {
+            sol::error err = transpiled;
+            ECLIPSE_LOG_ERROR("[Eclipse]: Error transpiling MoonScript `{}`: {}", filePath, err.what());
+            EclipseMetrics::GetInstance().Increment(METRIC_COMPILE_ERRORS);
+            return std::nullopt;
+        }
+
+        // to_lua returns the code, or nil and the parse error
+        sol::optional<std::string> luaCode = transpiled.get<sol::optional<std::string>>(0);
+        if (!luaCode)
+        {
+            sol::optional<std::string> err = transpiled.get<sol::optional<std::string>>(1);
+            ECLIPSE_LOG_ERROR("[Eclipse]: Error transpiling MoonScript `{}`: {}", filePath, err ? *err : "unknown error");
+            EclipseMetrics::GetInstance().Increment(METRIC_COMPILE_ERRORS);
+            return std::nullopt;
+        }
+
+        return CompileLuaToByteCode(moonState, filePath, *luaCode);
+    }
+    catch (const std::exception& e)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Exception transpiling MoonScript `{}`: {}", filePath, e.what());
+    }
+
+    EclipseMetrics::GetInstance().Increment(METRIC_COMPILE_ERRORS);
+    return std::nullopt;
+}
+
+/**
+ * Static scan for require calls with a literal module name, `require "a"`, `require('a')`, ...
+ * Comments and strings are skipped, dynamic requires are only resolved at runtime.
+ * Lua and MoonScript share the syntax for both.
+ */
+std::vector<std::string> EclipseCompiler::GetRequiredModules(std::string_view source)
+{
+    std::vector<std::string> modules;
+    SourceScanner scanner(source);
+
+    std::string_view identifier;
+    std::size_t start;
+    while (scanner.NextIdentifier(identifier, start))
+    {
+        // Field or method named require, not the global function
+        char previous = scanner.GetPreviousChar(start);
+        if (identifier != "require" || previous == '.' || previous == ':')
+            continue;
+
+        std::string moduleName;
+        if (scanner.ReadStringArgument(moduleName) && !moduleName.empty() &&
+            std::find(modules.begin(), modules.end(), moduleName) == modules.end())
+            modules.push_back(std::move(moduleName));
+    }
+
+    return modules;
+}
+
+/**
+ * Function definitions by line, the side table of stripped bytecode. Stripped frames still know
+ * the line their function was defined on, which is matched against these.
+ */
+ScriptDebugInfo EclipseCompiler::GetDebugInfo(std::string_view source)
+{
+    ScriptDebugInfo debugInfo;
+    SourceScanner scanner(source);
+
+    std::string_view identifier;
+    std::size_t start;
+    while (scanner.NextIdentifier(identifier, start))
+    {
+        if (identifier != "function")
+            continue;
+
+        std::string_view name = scanner.PeekName();
+        if (name.empty())
+            name = scanner.GetAssignedName(start);
+
+        std::string functionName = name.empty() ? "anonymous" : std::string(name);
+        if (!name.empty() && scanner.GetPreviousName(start) == "local")
+            functionName = "local " + functionName;
+
+        debugInfo.functions.push_back({ scanner.GetLine(start), std::move(functionName) });
+    }
+
+    return debugInfo;
+}
+
+/**
+ * Instruction a Lua frame is at and the size of its function, what stripped frames need to find their line
+ */
+bool EclipseCompiler::GetCurrentInstruction(const lua_Debug& ar, uint32& instruction, uint32& instructionCount)
+{
+#ifdef ECLIPSE_LUA_INTERNALS
+    CallInfo* ci = ar.i_ci;
+    if (!ci || !isLua(ci))
+        return false;
+
+    const Proto* proto = ci_func(ci)->p;
+    int pc = pcRel(ci->u.l.savedpc, proto);
+    if (pc < 0 || pc >= proto->sizecode)
+        return false;
+
+    instruction = static_cast<uint32>(pc);
+    instructionCount = static_cast<uint32>(proto->sizecode);
+    return true;
+#else
+    (void)ar;
+    (void)instruction;
+    (void)instructionCount;
+    return false;
+#endif
+}
@@ -8,6 +8,10 @@
 #define ECLIPSE_LUA_COMPILER_HPP
 
 #include "EclipseIncludes.hpp"
+#include "EclipseCache.hpp"
+
+#include <memory>
+#include <vector>
 
 class EclipseCompiler
 {
@@ -16,7 +20,18 @@ class EclipseCompiler
         ~EclipseCompiler() = default;
 
         static std::optional<sol::bytecode> CompileLuaToByteCode(sol::state& compilerState, const std::string& filePath);
-        static sol::bytecode CompileMoonToByteCode(const std::string& filePath);
+        // With `strippedDebugInfo` the bytecode is stripped and its side table stored there, left empty when it could not be
+        static std::optional<sol::bytecode> CompileLuaToByteCode(sol::state& compilerState, const std::string& filePath, std::string_view source, std::shared_ptr<const ScriptDebugInfo>* strippedDebugInfo = nullptr);
+        static bool DumpStrippedByteCode(sol::state& compilerState, const sol::protected_function& target, const std::string& chunkName, sol::bytecode& bytecode, ScriptDebugInfo& debugInfo);
+        static bool CanStripByteCode();
+        static bool GetCurrentInstruction(const lua_Debug& ar, uint32& instruction, uint32& instructionCount);
+        static std::optional<sol::bytecode> CompileMoonToByteCode(sol::state& moonState, const std::string& filePath);
+        static std::optional<sol::bytecode> CompileMoonToByteCode(sol::state& moonState, const std::string& filePath, std::string_view source);
+
+        static std::unique_ptr<sol::state> CreateMoonCompilerState(const std::string& requirePath, const std::string& requireCPath);
+
+        static std::vector<std::string> GetRequiredModules(std::string_view source);
+        static ScriptDebugInfo GetDebugInfo(std::string_view source);
 };
 
 #endif // ECLIPSE_LUA_COMPILER_HPP
\ No newline at end of file
@@ -33,10 +33,25 @@ void EclipseConfig::BuildConfigCache()
     SetConfigValue<bool>(EclipseConfigValues::ENABLED,                    "Eclipse.Enabled",            "false");
     SetConfigValue<bool>(EclipseConfigValues::AUTORELOAD_ENABLED,         "Eclipse.AutoReload",         "false");
     SetConfigValue<bool>(EclipseConfigValues::BYTECODE_CACHE_ENABLED,     "Eclipse.BytecodeCache",      "false");
+    SetConfigValue<bool>(EclipseConfigValues::STRIP_BYTECODE_ENABLED,     "Eclipse.StripBytecode",      "false");
+    SetConfigValue<bool>(EclipseConfigValues::ASYNC_LOG_ENABLED,          "Eclipse.AsyncLog",           "false");
 
     SetConfigValue<std::string>(EclipseConfigValues::SCRIPT_PATH,         "Eclipse.ScriptPath",         "lua_scripts");
     SetConfigValue<std::string>(EclipseConfigValues::REQUIRE_PATH,        "Eclipse.RequirePaths",       "");
     SetConfigValue<std::string>(EclipseConfigValues::REQUIRE_CPATH,       "Eclipse.RequireCPaths",      "");
+    SetConfigValue<std::string>(EclipseConfigValues::BYTECODE_CACHE_PATH, "Eclipse.BytecodeCachePath",  "lua_cache");
+    SetConfigValue<std::string>(EclipseConfigValues::GC_MODE,             "Eclipse.GCMode",             "auto");
+    SetConfigValue<std::string>(EclipseConfigValues::SCRIPT_BUNDLE,       "Eclipse.ScriptBundle",       "");
 
     SetConfigValue<uint32>(EclipseConfigValues::AUTORELOAD_INTERVAL,      "Eclipse.AutoReloadInterval", 1);
+    SetConfigValue<uint32>(EclipseConfigValues::COMPILER_THREADS,         "Eclipse.CompilerThreads",    0);
+    SetConfigValue<uint32>(EclipseConfigValues::STATE_MEMORY_LIMIT,       "Eclipse.StateMemoryLimit",   0);
+    SetConfigValue<uint32>(EclipseConfigValues::STATE_POOL_SIZE,          "Eclipse.StatePoolSize",      0);
+    SetConfigValue<uint32>(EclipseConfigValues::STATE_POOL_REFILL_THRESHOLD, "Eclipse.StatePoolRefillThreshold", 0);
+    SetConfigValue<uint32>(EclipseConfigValues::MESSAGE_QUEUE_SIZE,       "Eclipse.MessageQueueSize",   1024);
+    SetConfigValue<uint32>(EclipseConfigValues::GC_STEP_BUDGET,           "Eclipse.GCStepBudget",       1000);
+    SetConfigValue<uint32>(EclipseConfigValues::LOG_BUFFER_SIZE,          "Eclipse.LogBufferSize",      4096);
+    SetConfigValue<uint32>(EclipseConfigValues::LOG_RATE_LIMIT,           "Eclipse.LogRateLimit",       0);
+    SetConfigValue<uint32>(EclipseConfigValues::EXECUTION_INSTRUCTION_LIMIT, "Eclipse.ExecutionInstructionLimit", 0);
+    SetConfigValue<uint32>(EclipseConfigValues::EXECUTION_TIME_LIMIT,     "Eclipse.ExecutionTimeLimit", 0);
 }
\ No newline at end of file
@@ -15,14 +15,29 @@ enum class EclipseConfigValues : uint32
     ENABLED = 0,
     AUTORELOAD_ENABLED,
     BYTECODE_CACHE_ENABLED,
+    STRIP_BYTECODE_ENABLED,
+    ASYNC_LOG_ENABLED,
 
     // String
     SCRIPT_PATH,
     REQUIRE_PATH,
     REQUIRE_CPATH,
+    BYTECODE_CACHE_PATH,
+    GC_MODE,
+    SCRIPT_BUNDLE,
 
     // Number
     AUTORELOAD_INTERVAL,
+    COMPILER_THREADS,
+    STATE_MEMORY_LIMIT,
+    STATE_POOL_SIZE,
+    STATE_POOL_REFILL_THRESHOLD,
+    MESSAGE_QUEUE_SIZE,
+    GC_STEP_BUDGET,
+    LOG_BUFFER_SIZE,
+    LOG_RATE_LIMIT,
+    EXECUTION_INSTRUCTION_LIMIT,
+    EXECUTION_TIME_LIMIT,
 
     CONFIG_VALUE_COUNT
 };
@@ -37,12 +52,27 @@ class EclipseConfig final : public ConfigValueCache<EclipseConfigValues>
         bool IsEclipseEnabled() const { return GetConfigValue<bool>(EclipseConfigValues::ENABLED); }
         bool IsAutoReloadEnabled() const { return GetConfigValue<bool>(EclipseConfigValues::AUTORELOAD_ENABLED); }
         bool IsByteCodeCacheEnabled() const { return GetConfigValue<bool>(EclipseConfigValues::BYTECODE_CACHE_ENABLED); }
+        bool IsStripBytecodeEnabled() const { return GetConfigValue<bool>(EclipseConfigValues::STRIP_BYTECODE_ENABLED); }
+        bool IsAsyncLogEnabled() const { return GetConfigValue<bool>(EclipseConfigValues::ASYNC_LOG_ENABLED); }
 
         std::string_view GetScriptPath() const { return GetConfigValue(EclipseConfigValues::SCRIPT_PATH); }
         std::string_view GetRequirePath() const { return GetConfigValue(EclipseConfigValues::REQUIRE_PATH); }
         std::string_view GetRequireCPath() const { return GetConfigValue(EclipseConfigValues::REQUIRE_CPATH); }
+        std::string_view GetByteCodeCachePath() const { return GetConfigValue(EclipseConfigValues::BYTECODE_CACHE_PATH); }
+        std::string_view GetGCMode() const { return GetConfigValue(EclipseConfigValues::GC_MODE); }
+        std::string_view GetScriptBundle() const { return GetConfigValue(EclipseConfigValues::SCRIPT_BUNDLE); }
 
         uint32 GetAutoReloadInterval() const { return GetConfigValue<uint32>(EclipseConfigValues::AUTORELOAD_INTERVAL); }
+        uint32 GetCompilerThreads() const { return GetConfigValue<uint32>(EclipseConfigValues::COMPILER_THREADS); }
+        uint32 GetStateMemoryLimit() const { return GetConfigValue<uint32>(EclipseConfigValues::STATE_MEMORY_LIMIT); }
+        uint32 GetStatePoolSize() const { return GetConfigValue<uint32>(EclipseConfigValues::STATE_POOL_SIZE); }
+        uint32 GetStatePoolRefillThreshold() const { return GetConfigValue<uint32>(EclipseConfigValues::STATE_POOL_REFILL_THRESHOLD); }
+        uint32 GetMessageQueueSize() const { return GetConfigValue<uint32>(EclipseConfigValues::MESSAGE_QUEUE_SIZE); }
+        uint32 GetGCStepBudget() const { return GetConfigValue<uint32>(EclipseConfigValues::GC_STEP_BUDGET); }
+        uint32 GetLogBufferSize() const { return GetConfigValue<uint32>(EclipseConfigValues::LOG_BUFFER_SIZE); }
+        uint32 GetLogRateLimit() const { return GetConfigValue<uint32>(EclipseConfigValues::LOG_RATE_LIMIT); }
+        uint32 GetExecutionInstructionLimit() const { return GetConfigValue<uint32>(EclipseConfigValues::EXECUTION_INSTRUCTION_LIMIT); }
+        uint32 GetExecutionTimeLimit() const { return GetConfigValue<uint32>(EclipseConfigValues::EXECUTION_TIME_LIMIT); }
 
     protected:
         void BuildConfigCache() override;
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseEventRegistry.hpp"
+
+#include <algorithm>
+
+/**
+ *
+ */
+const char* EclipseEventRegistry::GetEventName(uint16 eventId)
+{
+    static const std::array<const char*, ECLIPSE_EVENT_COUNT> eventNames{
+        "WORLD_EVENT_ON_UPDATE",
+        "MAP_EVENT_ON_UPDATE",
+        "MAP_EVENT_ON_PLAYER_ENTER",
+        "MAP_EVENT_ON_PLAYER_LEAVE",
+        "CREATURE_EVENT_ON_UPDATE",
+        "CREATURE_EVENT_ON_SPAWN",
+        "CREATURE_EVENT_ON_DEATH",
+        "PLAYER_EVENT_ON_LOGIN",
+        "PLAYER_EVENT_ON_LOGOUT",
+        "PLAYER_EVENT_ON_MOVE",
+        "PLAYER_EVENT_ON_SPELL_CAST",
+        "PLAYER_EVENT_ON_CHAT"
+    };
+
+    return eventId < ECLIPSE_EVENT_COUNT ? eventNames[eventId] : "UNKNOWN_EVENT";
+}
+
+/**
+ *
+ */
+EclipseEventRegistry::HandlerId EclipseEventRegistry::Register(uint16 eventId, sol::protected_function handler, const std::string& owner, const ExecutionLimits& limits)
+{
+    if (eventId >= ECLIPSE_EVENT_COUNT || !handler.valid())
+        return 0;
+
+    Handler entry{ _nextHandlerId++, eventId, std::move(handler), owner, limits };
+    HandlerId handlerId = entry.id;
+
+    if (_dispatchDepth)
+        _pendingHandlers.push_back(std::move(entry));
+    else
+        Insert(std::move(entry));
+
+    return handlerId;
+}
+
+/**
+ *
+ */
+bool EclipseEventRegistry::Unregister(HandlerId handlerId)
+{
+    if (!handlerId)
+        return false;
+
+    for (auto& handlers : _handlers)
+    {
+        for (Handler& handler : handlers)
+        {
+            if (handler.id != handlerId)
+                continue;
+
+            handler.id = 0;
+            _pendingCompaction = true;
+            if (!_dispatchDepth)
+                Compact();
+            return true;
+        }
+    }
+
+    auto it = std::find_if(_pendingHandlers.begin(), _pendingHandlers.end(), [handlerId](const Handler& handler) { return handler.id == handlerId; });
+    if (it == _pendingHandlers.end())
+        return false;
+
+    _pendingHandlers.erase(it);
+    return true;
+}
+
+/**
+ *
+ */
+void EclipseEventRegistry::Clear(uint16 eventId)
+{
+    if (eventId >= ECLIPSE_EVENT_COUNT)
+        return;
+
+    for (Handler& handler : _handlers[eventId])
+        handler.id = 0;
+
+    std::erase_if(_pendingHandlers, [eventId](const Handler& handler) { return handler.eventId == eventId; });
+
+    _pendingCompaction = true;
+    if (!_dispatchDepth)
+        Compact();
+}
+
+/**
+ *
+ */
+void EclipseEventRegistry::ClearOwner(const std::string& owner)
+{
+    for (auto& handlers : _handlers)
+        for (Handler& handler : handlers)
+            if (handler.owner == owner)
+                handler.id = 0;
+
+    std::erase_if(_pendingHandlers, [&owner](const Handler& handler) { return handler.owner == owner; });
+
+    _pendingCompaction = true;
+    if (!_dispatchDepth)
+        Compact();
+}
+
+/**
+ *
+ */
+void EclipseEventRegistry::ClearAll()
+{
+    for (uint16 eventId = 0; eventId < ECLIPSE_EVENT_COUNT; ++eventId)
+        Clear(eventId);
+}
+
+/**
+ *
+ */
+void EclipseEventRegistry::Insert(Handler&& handler)
+{
+    uint16 eventId = handler.eventId;
+    _handlers[eventId].push_back(std::move(handler));
+    _activeEvents.set(eventId);
+}
+
+/**
+ *
+ */
+void EclipseEventRegistry::Compact()
+{
+    if (!_pendingCompaction)
+        return;
+
+    for (uint16 eventId = 0; eventId < ECLIPSE_EVENT_COUNT; ++eventId)
+    {
+        auto& handlers = _handlers[eventId];
+        std::erase_if(handlers, [](const Handler& handler) { return !handler.id; });
+        _activeEvents.set(eventId, !handlers.empty());
+    }
+
+    _pendingCompaction = false;
+}
+
+/**
+ *
+ */
+void EclipseEventRegistry::FlushPending()
+{
+    Compact();
+
+    for (Handler& handler : _pendingHandlers)
+        Insert(std::move(handler));
+
+    _pendingHandlers.clear();
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_EVENT_REGISTRY_HPP
+#define ECLIPSE_EVENT_REGISTRY_HPP
+
+#include "EclipseIncludes.hpp"
+#include "EclipseExecutionBudget.hpp"
+#include "EclipseLogger.hpp"
+
+#include <array>
+#include <bitset>
+
+enum EclipseEventId : uint16
+{
+    // World
+    WORLD_EVENT_ON_UPDATE = 0,
+
+    // Map
+    MAP_EVENT_ON_UPDATE,
+    MAP_EVENT_ON_PLAYER_ENTER,
+    MAP_EVENT_ON_PLAYER_LEAVE,
+
+    // Creature
+    CREATURE_EVENT_ON_UPDATE,
+    CREATURE_EVENT_ON_SPAWN,
+    CREATURE_EVENT_ON_DEATH,
+
+    // Player
+    PLAYER_EVENT_ON_LOGIN,
+    PLAYER_EVENT_ON_LOGOUT,
+    PLAYER_EVENT_ON_MOVE,
+    PLAYER_EVENT_ON_SPELL_CAST,
+    PLAYER_EVENT_ON_CHAT,
+
+    ECLIPSE_EVENT_COUNT
+};
+
+// Per state handler table. Each event owns a contiguous array of pre-resolved functions and a bit
+// telling whether anything is registered, so an unhooked event costs a single bit test.
+class EclipseEventRegistry
+{
+    public:
+        typedef uint32 HandlerId;
+
+        EclipseEventRegistry() = default;
+
+        static const char* GetEventName(uint16 eventId);
+
+        bool HasHandlers(uint16 eventId) const { return eventId < ECLIPSE_EVENT_COUNT && _activeEvents.test(eventId); }
+
+        // Handlers run under the state's execution budget, their own limits replace its defaults
+        void SetBudget(EclipseExecutionBudget* budget) { _budget = budget; }
+
+        HandlerId Register(uint16 eventId, sol::protected_function handler, const std::string& owner = "", const ExecutionLimits& limits = {});
+        bool Unregister(HandlerId handlerId);
+        void Clear(uint16 eventId);
+        void ClearOwner(const std::string& owner);
+        void ClearAll();
+
+        template<typename... Args>
+        uint32 Trigger(uint16 eventId, Args&&... args)
+        {
+            if (!HasHandlers(eventId))
+                return 0;
+
+            // Handlers registered while dispatching are queued, removed ones are compacted afterwards
+            ++_dispatchDepth;
+
+            uint32 called = 0;
+            for (Handler& handler : _handlers[eventId])
+            {
+                if (!handler.id)
+                    continue;
+
+                EclipseBudgetScope budgetScope(_budget, handler.owner, handler.limits);
+                sol::protected_function_result result = handler.function(args...);
+                if (!result.valid())
+                {
+                    sol::error err = result;
+                    ECLIPSE_LOG_ERROR("[Eclipse]: Error in {} handler registered by `{}`: {}", GetEventName(eventId), handler.owner, err.what());
+                }
+                ++called;
+            }
+
+            if (!--_dispatchDepth)
+                FlushPending();
+
+            return called;
+        }
+
+    private:
+        EclipseEventRegistry(const EclipseEventRegistry&) = delete;
+        EclipseEventRegistry& operator=(const EclipseEventRegistry&) = delete;
+
+        struct Handler
+        {
+            HandlerId id;
+            uint16 eventId;
+            sol::protected_function function;
+            std::string owner;
+            ExecutionLimits limits;
+        };
+
+        void Insert(Handler&& handler);
+        void Compact();
+        void FlushPending();
+
+        std::array<std::vector<Handler>, ECLIPSE_EVENT_COUNT> _handlers;
+        std::bitset<ECLIPSE_EVENT_COUNT> _activeEvents;
+
+        std::vector<Handler> _pendingHandlers;
+        bool _pendingCompaction = false;
+        uint32 _dispatchDepth = 0;
+        HandlerId _nextHandlerId = 1;
+        EclipseExecutionBudget* _budget = nullptr;
+};
+
+#endif // ECLIPSE_EVENT_REGISTRY_HPP
@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseExecutionBudget.hpp"
+#include "EclipseMetrics.hpp"
+
+EclipseExecutionBudget::~EclipseExecutionBudget()
+{
+    if (_hook)
+        _hook->ClearClient(HOOK_CLIENT_BUDGET);
+}
+
+/**
+ *
+ */
+void EclipseExecutionBudget::Initialize(EclipseHook& hook, const ExecutionLimits& defaults)
+{
+    _hook = &hook;
+    _defaults = defaults;
+
+    // Coroutines only get the hook if it is there when they are created. Without defaults a state
+    // runs hook free, handlers with their own limits install it around their own call.
+    if (!_defaults.IsUnlimited())
+        _hook->SetClient(HOOK_CLIENT_BUDGET, CHECK_PERIOD, &EclipseExecutionBudget::Hook, this);
+}
+
+/**
+ *
+ */
+bool EclipseExecutionBudget::Begin(const std::string& owner, const ExecutionLimits& limits, lua_State* thread)
+{
+    if (_armed || !_hook)
+        return false;
+
+    _limits = limits.Or(_defaults);
+    if (_limits.IsUnlimited())
+        return false;
+
+    _thread = thread;
+    _installed = !_hook->HasClient(HOOK_CLIENT_BUDGET);
+    if (_installed)
+    {
+        _hook->SetClient(HOOK_CLIENT_BUDGET, CHECK_PERIOD, &EclipseExecutionBudget::Hook, this);
+        _hook->ApplyTo(_thread);
+    }
+
+    _armed = true;
+    _tripped = false;
+    _executed = 0;
+    _deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_limits.timeMs);
+    _owner = owner;
+    return true;
+}
+
+/**
+ *
+ */
+void EclipseExecutionBudget::End()
+{
+    if (!_armed)
+        return;
+
+    _armed = false;
+    if (_installed)
+        _hook->ClearClient(HOOK_CLIENT_BUDGET);
+    else if (_tripped)
+        _hook->SetClient(HOOK_CLIENT_BUDGET, CHECK_PERIOD, &EclipseExecutionBudget::Hook, this);
+
+    // A trip moved the coroutine to a hook on every instruction
+    if (_installed || _tripped)
+        _hook->ApplyTo(_thread);
+
+    _installed = false;
+    _tripped = false;
+    _thread = nullptr;
+}
+
+/**
+ *
+ */
+std::string EclipseExecutionBudget::GetLastOffender() const
+{
+    std::lock_guard<std::mutex> guard(_offenderLock);
+    return _lastOffender;
+}
+
+/**
+ *
+ */
+void EclipseExecutionBudget::Hook(void* owner, lua_State* L)
+{
+    static_cast<EclipseExecutionBudget*>(owner)->Check(L);
+}
+
+/**
+ * Raises the error itself, nothing with a destructor may be alive at that point
+ */
+void EclipseExecutionBudget::Check(lua_State* L)
+{
+    if (!_armed)
+        return;
+
+    if (!_tripped)
+    {
+        _executed += CHECK_PERIOD;
+        if (_limits.instructions && _executed > _limits.instructions)
+            Trip();
+        else if (_limits.timeMs && std::chrono::steady_clock::now() >= _deadline)
+            Trip();
+        else
+            return;
+
+        // The running thread may be a coroutine, the main thread is switched by the hook
+        lua_sethook(L, lua_gethook(L), lua_gethookmask(L), 1);
+    }
+
+    if (_limits.instructions && _executed > _limits.instructions)
+        luaL_error(L, "`%s` exceeded its execution budget of %d instructions", _owner.c_str(), static_cast<int>(_limits.instructions));
+    else
+        luaL_error(L, "`%s` exceeded its execution budget of %d ms", _owner.c_str(), static_cast<int>(_limits.timeMs));
+}
+
+/**
+ * From now on the hook runs on every instruction until the callback has returned
+ */
+void EclipseExecutionBudget::Trip()
+{
+    _tripped = true;
+
+    _exceeded.fetch_add(1, std::memory_order_relaxed);
+    EclipseMetrics::GetInstance().Increment(METRIC_BUDGETS_EXCEEDED);
+    {
+        std::lock_guard<std::mutex> guard(_offenderLock);
+        _lastOffender = _owner;
+    }
+
+    _hook->SetClient(HOOK_CLIENT_BUDGET, 1, &EclipseExecutionBudget::Hook, this);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_EXECUTION_BUDGET_HPP
+#define ECLIPSE_EXECUTION_BUDGET_HPP
+
+#include "EclipseIncludes.hpp"
+#include "EclipseHook.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+// 0 is unlimited
+struct ExecutionLimits
+{
+    uint32 instructions = 0;
+    uint32 timeMs = 0;
+
+    bool IsUnlimited() const { return !instructions && !timeMs; }
+
+    // Limits left at 0 take the default one
+    ExecutionLimits Or(const ExecutionLimits& defaults) const
+    {
+        return { instructions ? instructions : defaults.instructions, timeMs ? timeMs : defaults.timeMs };
+    }
+};
+
+// Instruction and wall clock budget of the callback a state is running, checked from the count hook
+// every CHECK_PERIOD instructions. An exceeded budget raises a Lua error, and raises it again on every
+// following instruction until the callback has returned, so a pcall in the runaway code cannot keep it going.
+class EclipseExecutionBudget
+{
+    public:
+        static constexpr uint32 CHECK_PERIOD = 1000;
+
+        EclipseExecutionBudget() = default;
+        ~EclipseExecutionBudget();
+
+        // With defaults the hook is installed right away, otherwise only while a handler with its own limits runs
+        void Initialize(EclipseHook& hook, const ExecutionLimits& defaults);
+        const ExecutionLimits& GetDefaults() const { return _defaults; }
+
+        // Callbacks started from a running one count against the outer budget, false when nothing was armed.
+        // `thread` is the coroutine about to run, nullptr for the main thread.
+        bool Begin(const std::string& owner, const ExecutionLimits& limits, lua_State* thread = nullptr);
+        void End();
+        bool IsArmed() const { return _armed; }
+
+        uint64 GetExceededCount() const { return _exceeded.load(std::memory_order_relaxed); }
+        std::string GetLastOffender() const;
+
+    private:
+        EclipseExecutionBudget(const EclipseExecutionBudget&) = delete;
+        EclipseExecutionBudget& operator=(const EclipseExecutionBudget&) = delete;
+
+        static void Hook(void* owner, lua_State* L);
+        void Check(lua_State* L);
+        void Trip();
+
+        EclipseHook* _hook = nullptr;
+        ExecutionLimits _defaults;
+
+        bool _armed = false;
+        bool _tripped = false;
+        bool _installed = false;        // hook set by Begin for this callback only
+        lua_State* _thread = nullptr;
+        ExecutionLimits _limits;
+        uint64 _executed = 0;
+        std::chrono::steady_clock::time_point _deadline;
+        std::string _owner;
+
+        // Read by the metrics report from other threads
+        std::atomic<uint64> _exceeded{ 0 };
+        mutable std::mutex _offenderLock;
+        std::string _lastOffender;
+};
+
+// Arms the budget for the lifetime of the scope
+class EclipseBudgetScope
+{
+    public:
+        EclipseBudgetScope(EclipseExecutionBudget* budget, const std::string& owner, const ExecutionLimits& limits = {}, lua_State* thread = nullptr) :
+        _budget(budget && budget->Begin(owner, limits, thread) ? budget : nullptr)
+        {
+        }
+
+        ~EclipseBudgetScope()
+        {
+            if (_budget)
+                _budget->End();
+        }
+
+    private:
+        EclipseBudgetScope(const EclipseBudgetScope&) = delete;
+        EclipseBudgetScope& operator=(const EclipseBudgetScope&) = delete;
+
+        EclipseExecutionBudget* _budget;
+};
+
+#endif // ECLIPSE_EXECUTION_BUDGET_HPP
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseGarbageCollector.hpp"
+#include "EclipseLogger.hpp"
+#include "EclipseMetrics.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace
+{
+    std::atomic<bool> generationalFallbackLogged = false;
+}
+
+/**
+ * Unknown modes fall back to Lua's own pacing
+ */
+EclipseGCMode EclipseGarbageCollector::ParseMode(std::string_view mode)
+{
+    if (mode == "stepped")
+        return GC_MODE_STEPPED;
+
+    if (mode == "generational")
+        return GC_MODE_GENERATIONAL;
+
+    if (mode != "auto")
+        ECLIPSE_LOG_WARN("[Eclipse]: Unknown GC mode `{}`, expected auto, stepped or generational", mode);
+
+    return GC_MODE_AUTO;
+}
+
+/**
+ *
+ */
+const char* EclipseGarbageCollector::GetModeName(EclipseGCMode mode)
+{
+    switch (mode)
+    {
+        case GC_MODE_STEPPED:       return "stepped";
+        case GC_MODE_GENERATIONAL:  return "generational";
+        default:                    return "auto";
+    }
+}
+
+/**
+ *
+ */
+void EclipseGarbageCollector::Initialize(lua_State* L, EclipseGCMode mode, uint32 budgetUs)
+{
+    _luaState = L;
+    SetBudget(budgetUs);
+    SetMode(mode);
+}
+
+/**
+ *
+ */
+void EclipseGarbageCollector::SetMode(EclipseGCMode mode)
+{
+#if LUA_VERSION_NUM < 504
+    if (mode == GC_MODE_GENERATIONAL)
+    {
+        if (!generationalFallbackLogged.exchange(true))
+            ECLIPSE_LOG_WARN("[Eclipse]: Generational GC is not supported by this Lua VM, states use stepped collection");
+
+        mode = GC_MODE_STEPPED;
+    }
+#endif
+
+    _mode = mode;
+    _cycleRunning = false;
+    _lastHeap = GetHeapBytes();
+    _threshold = std::max(_lastHeap * 2, MIN_THRESHOLD);
+    _hardLimit = std::max(_lastHeap, MIN_THRESHOLD) * HARD_LIMIT_FACTOR;
+
+    if (!_luaState)
+        return;
+
+    switch (mode)
+    {
+        case GC_MODE_STEPPED:
+#if LUA_VERSION_NUM >= 504
+            // A basic step does 2^stepsize bytes of work, that is what adapts on 5.4
+            lua_gc(_luaState, LUA_GCINC, 0, 0, std::bit_width(_stepSize) - 1 + 10);
+#endif
+            lua_gc(_luaState, LUA_GCSTOP, 0);
+            break;
+#if LUA_VERSION_NUM >= 504
+        case GC_MODE_GENERATIONAL:
+            lua_gc(_luaState, LUA_GCGEN, 0, 0);
+            lua_gc(_luaState, LUA_GCRESTART, 0);
+            break;
+#endif
+        default:
+#if LUA_VERSION_NUM >= 504
+            lua_gc(_luaState, LUA_GCINC, 0, 0, 0);
+#endif
+            lua_gc(_luaState, LUA_GCRESTART, 0);
+            break;
+    }
+}
+
+/**
+ * At least one step runs once a cycle is due, a budget of 0 means exactly one per tick.
+ * Past the hard limit the cycle is finished right away, whatever the budget.
+ */
+uint64 EclipseGarbageCollector::Step()
+{
+    if (_mode != GC_MODE_STEPPED || !_luaState)
+        return 0;
+
+    uint64 heap = GetHeapBytes();
+    if (!_cycleRunning)
+    {
+        if (heap < _threshold)
+        {
+            _lastHeap = heap;
+            return 0;
+        }
+
+        _cycleRunning = true;
+    }
+
+    if (heap >= _hardLimit)
+    {
+        auto start = std::chrono::steady_clock::now();
+        lua_gc(_luaState, LUA_GCCOLLECT, 0);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        ECLIPSE_LOG_DEBUG("[Eclipse]: Heap reached {} bytes against a hard limit of {}, collected in full in {} µs", heap, _hardLimit, elapsed.count());
+        FinishCycle();
+        EclipseMetrics::GetInstance().Record(METRIC_GC_STEP_TIME, elapsed.count());
+        return elapsed.count();
+    }
+
+#if LUA_VERSION_NUM >= 504
+    int stepData = 0;
+#else
+    int stepData = static_cast<int>(_stepSize);
+#endif
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + _budget;
+
+    uint32 steps = 0;
+    bool finished = false;
+    do
+    {
+        finished = lua_gc(_luaState, LUA_GCSTEP, stepData) != 0;
+        ++steps;
+    } while (!finished && std::chrono::steady_clock::now() < deadline);
+
+#if LUA_VERSION_NUM < 504
+    // Stepping rearms the automatic threshold on 5.1 VMs
+    lua_gc(_luaState, LUA_GCSTOP, 0);
+#endif
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    // Single steps eating a quarter of the budget overshoot it, a heap still growing mid cycle
+    // means the tick allocates faster than the budget collects. Without a budget any step fits.
+    uint32 stepSize = _stepSize;
+    if (_budget.count() && elapsed / steps > _budget / 4)
+        stepSize = std::max(_stepSize / 2, MIN_STEP_KB);
+    else if (!finished && heap > _lastHeap)
+        stepSize = std::min(_stepSize * 2, MAX_STEP_KB);
+
+    if (stepSize != _stepSize)
+    {
+        _stepSize = stepSize;
+#if LUA_VERSION_NUM >= 504
+        lua_gc(_luaState, LUA_GCINC, 0, 0, std::bit_width(_stepSize) - 1 + 10);
+#endif
+    }
+
+    _lastHeap = GetHeapBytes();
+    if (finished)
+        FinishCycle();
+
+    EclipseMetrics::GetInstance().Record(METRIC_GC_STEP_TIME, elapsed.count());
+    return elapsed.count();
+}
+
+/**
+ * What is left after a complete cycle is the live size, both limits follow it
+ */
+void EclipseGarbageCollector::FinishCycle()
+{
+    _cycleRunning = false;
+    _lastHeap = GetHeapBytes();
+    _threshold = std::max(_lastHeap * 2, MIN_THRESHOLD);
+    _hardLimit = std::max(_lastHeap, MIN_THRESHOLD) * HARD_LIMIT_FACTOR;
+    EclipseMetrics::GetInstance().Increment(METRIC_GC_CYCLES);
+}
+
+/**
+ *
+ */
+uint64 EclipseGarbageCollector::GetHeapBytes() const
+{
+    if (!_luaState)
+        return 0;
+
+    return static_cast<uint64>(lua_gc(_luaState, LUA_GCCOUNT, 0)) * 1024 + lua_gc(_luaState, LUA_GCCOUNTB, 0);
+}
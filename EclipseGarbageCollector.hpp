@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_GARBAGE_COLLECTOR_HPP
+#define ECLIPSE_GARBAGE_COLLECTOR_HPP
+
+#include "EclipseIncludes.hpp"
+
+#include <string_view>
+
+enum EclipseGCMode : uint8
+{
+    GC_MODE_AUTO,           // Lua's own pacing
+    GC_MODE_STEPPED,        // automatic collection off, budgeted steps at the end of the tick
+    GC_MODE_GENERATIONAL    // Lua 5.4 generational collector, stepped on older VMs
+};
+
+// Per state GC control. In stepped mode a cycle starts once the heap has doubled since the last one
+// and advances in incremental steps until the tick budget runs out. Steps too coarse for the budget
+// are shrunk, steps that let the heap keep growing during a cycle are grown. A heap that outruns the
+// budget anyway is collected in full once it reaches HARD_LIMIT_FACTOR times the live size.
+class EclipseGarbageCollector
+{
+    public:
+        static constexpr uint32 MIN_STEP_KB = 1;
+        static constexpr uint32 MAX_STEP_KB = 16 * 1024;
+        static constexpr uint32 DEFAULT_STEP_KB = 8; // Lua 5.4's own basic step
+        static constexpr uint64 MIN_THRESHOLD = 1024 * 1024;
+        static constexpr uint64 HARD_LIMIT_FACTOR = 4;
+
+        EclipseGarbageCollector() = default;
+
+        static EclipseGCMode ParseMode(std::string_view mode);
+        static const char* GetModeName(EclipseGCMode mode);
+
+        void Initialize(lua_State* L, EclipseGCMode mode, uint32 budgetUs);
+        void SetMode(EclipseGCMode mode);
+        void SetBudget(uint32 budgetUs) { _budget = std::chrono::microseconds(budgetUs); }
+
+        // End of the map tick, returns the time spent in microseconds
+        uint64 Step();
+
+        EclipseGCMode GetMode() const { return _mode; }
+        uint32 GetStepSize() const { return _stepSize; }
+        uint64 GetThreshold() const { return _threshold; }
+        uint64 GetHardLimit() const { return _hardLimit; }
+        bool IsCycleRunning() const { return _cycleRunning; }
+
+    private:
+        EclipseGarbageCollector(const EclipseGarbageCollector&) = delete;
+        EclipseGarbageCollector& operator=(const EclipseGarbageCollector&) = delete;
+
+        uint64 GetHeapBytes() const;
+        void FinishCycle();
+
+        lua_State* _luaState = nullptr;
+        EclipseGCMode _mode = GC_MODE_AUTO;
+        std::chrono::microseconds _budget{ 0 };
+
+        uint32 _stepSize = DEFAULT_STEP_KB;
+        uint64 _threshold = MIN_THRESHOLD;
+        uint64 _hardLimit = MIN_THRESHOLD * HARD_LIMIT_FACTOR;
+        uint64 _lastHeap = 0;
+        bool _cycleRunning = false;
+};
+
+#endif // ECLIPSE_GARBAGE_COLLECTOR_HPP
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseHash.hpp"
+
+#include <cstring>
+
+namespace
+{
+    constexpr uint64 PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64 PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr uint64 PRIME64_3 = 0x165667B19E3779F9ULL;
+    constexpr uint64 PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr uint64 PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+    inline uint64 RotateLeft(uint64 value, uint32 bits)
+    {
+        return (value << bits) | (value >> (64 - bits));
+    }
+
+    inline uint64 Read64(const uint8* ptr)
+    {
+        uint64 value;
+        std::memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+    inline uint32 Read32(const uint8* ptr)
+    {
+        uint32 value;
+        std::memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+    inline uint64 Round(uint64 acc, uint64 input)
+    {
+        acc += input * PRIME64_2;
+        acc = RotateLeft(acc, 31);
+        return acc * PRIME64_1;
+    }
+
+    inline uint64 MergeRound(uint64 acc, uint64 value)
+    {
+        acc ^= Round(0, value);
+        return acc * PRIME64_1 + PRIME64_4;
+    }
+}
+
+/**
+ *
+ */
+uint64 EclipseHash::Compute(const void* data, std::size_t size, uint64 seed)
+{
+    const uint8* ptr = static_cast<const uint8*>(data);
+    const uint8* const end = ptr + size;
+    uint64 hash;
+
+    if (size >= 32)
+    {
+        const uint8* const limit = end - 32;
+        uint64 v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64 v2 = seed + PRIME64_2;
+        uint64 v3 = seed;
+        uint64 v4 = seed - PRIME64_1;
+
+        do
+        {
+            v1 = Round(v1, Read64(ptr));
+            v2 = Round(v2, Read64(ptr + 8));
+            v3 = Round(v3, Read64(ptr + 16));
+            v4 = Round(v4, Read64(ptr + 24));
+            ptr += 32;
+        } while (ptr <= limit);
+
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        hash = MergeRound(hash, v1);
+        hash = MergeRound(hash, v2);
+        hash = MergeRound(hash, v3);
+        hash = MergeRound(hash, v4);
+    }
+    else
+        hash = seed + PRIME64_5;
+
+    hash += static_cast<uint64>(size);
+
+    for (; ptr + 8 <= end; ptr += 8)
+    {
+        hash ^= Round(0, Read64(ptr));
+        hash = RotateLeft(hash, 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    if (ptr + 4 <= end)
+    {
+        hash ^= static_cast<uint64>(Read32(ptr)) * PRIME64_1;
+        hash = RotateLeft(hash, 23) * PRIME64_2 + PRIME64_3;
+        ptr += 4;
+    }
+
+    for (; ptr < end; ++ptr)
+    {
+        hash ^= (*ptr) * PRIME64_5;
+        hash = RotateLeft(hash, 11) * PRIME64_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_HASH_HPP
+#define ECLIPSE_HASH_HPP
+
+#include "EclipseIncludes.hpp"
+
+#include <string_view>
+
+// XXH64 compatible hash used to detect script content changes
+class EclipseHash
+{
+    public:
+        static uint64 Compute(const void* data, std::size_t size, uint64 seed = 0);
+        static uint64 Compute(std::string_view data, uint64 seed = 0) { return Compute(data.data(), data.size(), seed); }
+
+    private:
+        EclipseHash() = delete;
+};
+
+#endif // ECLIPSE_HASH_HPP
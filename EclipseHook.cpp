@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseHook.hpp"
+
+#include <algorithm>
+
+namespace
+{
+    // Address used as the registry key pointing back to the hook of a state
+    char HOOK_REGISTRY_KEY;
+}
+
+EclipseHook::~EclipseHook()
+{
+    Detach();
+}
+
+/**
+ *
+ */
+void EclipseHook::Attach(lua_State* L)
+{
+    if (IsAttached() || !L)
+        return;
+
+    _luaState = L;
+    lua_pushlightuserdata(L, this);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &HOOK_REGISTRY_KEY);
+    Apply();
+}
+
+/**
+ * Clients are kept, attaching again brings their hook back
+ */
+void EclipseHook::Detach()
+{
+    if (!IsAttached())
+        return;
+
+    lua_sethook(_luaState, nullptr, 0, 0);
+    lua_pushnil(_luaState);
+    lua_rawsetp(_luaState, LUA_REGISTRYINDEX, &HOOK_REGISTRY_KEY);
+    _luaState = nullptr;
+    _period = 0;
+}
+
+/**
+ *
+ */
+void EclipseHook::SetClient(EclipseHookClient client, uint32 instructionPeriod, Callback callback, void* owner)
+{
+    if (client >= HOOK_CLIENT_COUNT)
+        return;
+
+    _clients[client] = Client{ callback, owner, std::max<uint32>(instructionPeriod, 1), 0 };
+    Apply();
+}
+
+/**
+ *
+ */
+void EclipseHook::ClearClient(EclipseHookClient client)
+{
+    if (client >= HOOK_CLIENT_COUNT)
+        return;
+
+    _clients[client] = Client();
+    Apply();
+}
+
+/**
+ * Installs the hook at the shortest client period, or removes it once nobody is left
+ */
+void EclipseHook::Apply()
+{
+    if (!IsAttached())
+        return;
+
+    uint32 period = 0;
+    for (const Client& client : _clients)
+        if (client.callback && (!period || client.period < period))
+            period = client.period;
+
+    // Set even when unchanged, a client may have changed the period of the main thread itself
+    _period = period;
+    if (period)
+        lua_sethook(_luaState, &EclipseHook::Dispatch, LUA_MASKCOUNT, static_cast<int>(period));
+    else
+        lua_sethook(_luaState, nullptr, 0, 0);
+}
+
+/**
+ *
+ */
+void EclipseHook::ApplyTo(lua_State* thread) const
+{
+    if (!IsAttached() || !thread || thread == _luaState)
+        return;
+
+    if (_period)
+        lua_sethook(thread, &EclipseHook::Dispatch, LUA_MASKCOUNT, static_cast<int>(_period));
+    else
+        lua_sethook(thread, nullptr, 0, 0);
+}
+
+/**
+ * Nothing with a destructor may live here, a client is allowed to raise a Lua error
+ */
+void EclipseHook::Dispatch(lua_State* L, lua_Debug* /*ar*/)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &HOOK_REGISTRY_KEY);
+    EclipseHook* hook = static_cast<EclipseHook*>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+
+    if (!hook)
+        return;
+
+    // A coroutine runs at the period its hook had when it was created
+    uint32 executed = static_cast<uint32>(std::max(lua_gethookcount(L), 1));
+    for (Client& client : hook->_clients)
+    {
+        if (!client.callback)
+            continue;
+
+        client.elapsed += executed;
+        if (client.elapsed < client.period)
+            continue;
+
+        client.elapsed = 0;
+        client.callback(client.owner, L);
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_HOOK_HPP
+#define ECLIPSE_HOOK_HPP
+
+#include "EclipseIncludes.hpp"
+
+#include <array>
+
+// Called in this order, a client raising a Lua error has to come last
+enum EclipseHookClient : uint8
+{
+    HOOK_CLIENT_PROFILER,
+    HOOK_CLIENT_BUDGET,
+
+    HOOK_CLIENT_COUNT
+};
+
+// The count hook of one Lua state, Lua only keeps one. Every client asks for its own instruction
+// period, the hook runs at the shortest one and calls a client once its own period has passed.
+// Coroutines take the hook of the main thread when they are created.
+class EclipseHook
+{
+    public:
+        typedef void (*Callback)(void* owner, lua_State* L);
+
+        EclipseHook() = default;
+        ~EclipseHook();
+
+        void Attach(lua_State* L);
+        void Detach();
+        bool IsAttached() const { return _luaState != nullptr; }
+
+        void SetClient(EclipseHookClient client, uint32 instructionPeriod, Callback callback, void* owner);
+        void ClearClient(EclipseHookClient client);
+        bool HasClient(EclipseHookClient client) const { return _clients[client].callback != nullptr; }
+
+        // Brings a coroutine in line with the main thread, clients only change the hook of the latter
+        void ApplyTo(lua_State* thread) const;
+
+        uint32 GetPeriod() const { return _period; }
+
+    private:
+        EclipseHook(const EclipseHook&) = delete;
+        EclipseHook& operator=(const EclipseHook&) = delete;
+
+        struct Client
+        {
+            Callback callback = nullptr;
+            void* owner = nullptr;
+            uint32 period = 0;
+            uint32 elapsed = 0;
+        };
+
+        static void Dispatch(lua_State* L, lua_Debug* ar);
+        void Apply();
+
+        lua_State* _luaState = nullptr;
+        std::array<Client, HOOK_CLIENT_COUNT> _clients;
+        uint32 _period = 0;
+};
+
+#endif // ECLIPSE_HOOK_HPP
@@ -6,6 +6,28 @@
 
 #include "EclipseIncludes.hpp"
 #include "EclipseLogger.hpp"
+#include "EclipseMetrics.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace
+{
+    // Retires the buffer when its thread exits, the drain thread frees it once empty
+    struct ThreadBufferHandle
+    {
+        std::shared_ptr<void> buffer;
+        std::atomic<bool>* retired = nullptr;
+
+        ~ThreadBufferHandle()
+        {
+            if (retired)
+                retired->store(true, std::memory_order_release);
+        }
+    };
+
+    thread_local ThreadBufferHandle threadBuffer;
+}
 
 EclipseLogger& EclipseLogger::GetInstance()
 {
@@ -13,6 +35,222 @@ EclipseLogger& EclipseLogger::GetInstance()
     return instance;
 }
 
+EclipseLogger::~EclipseLogger()
+{
+    Stop();
+}
+
+/**
+ *
+ */
+void EclipseLogger::Start(std::size_t bufferSize)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_running.load(std::memory_order_relaxed))
+        return;
+
+    {
+        std::lock_guard<std::mutex> buffersGuard(_buffersLock);
+        _bufferSize = std::max<std::size_t>(bufferSize, 2);
+    }
+
+    _running.store(true, std::memory_order_release);
+    _thread = std::thread(&EclipseLogger::Run, this);
+}
+
+/**
+ * Whatever was pushed before Stop returns is still written, later writes go to the core logger
+ */
+void EclipseLogger::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if (!_running.exchange(false))
+            return;
+    }
+
+    _condition.notify_all();
+    if (_thread.joinable())
+        _thread.join();
+
+    // A producer that still saw the logger running finishes its push before the last drain
+    {
+        std::lock_guard<std::mutex> guard(_buffersLock);
+        for (const std::shared_ptr<ThreadBuffer>& buffer : _buffers)
+            while (buffer->IsWriting())
+                std::this_thread::yield();
+    }
+
+    Drain();
+}
+
+/**
+ *
+ */
+void EclipseLogger::Write(LogLevel level, std::string&& message)
+{
+    if (!IsRunning())
+    {
+        sLog->outMessage(ECLIPSE_LOG_FILTER, level, "{}", message);
+        return;
+    }
+
+    // Checked again once the buffer is marked, Stop either sees the mark or the push goes direct
+    ThreadBuffer& buffer = GetThreadBuffer();
+    buffer.SetWriting(true);
+    if (!_running.load())
+    {
+        buffer.SetWriting(false);
+        sLog->outMessage(ECLIPSE_LOG_FILTER, level, "{}", message);
+        return;
+    }
+
+    bool pushed = buffer.Push(EclipseLogRecord{ level, std::move(message) });
+    buffer.SetWriting(false);
+
+    if (!pushed)
+    {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        EclipseMetrics::GetInstance().Increment(METRIC_LOG_LINES_DROPPED);
+    }
+}
+
+/**
+ * Registered once per thread, later writes do not touch any lock
+ */
+EclipseLogger::ThreadBuffer& EclipseLogger::GetThreadBuffer()
+{
+    if (!threadBuffer.buffer)
+    {
+        std::lock_guard<std::mutex> guard(_buffersLock);
+        auto buffer = std::make_shared<ThreadBuffer>(_bufferSize);
+        _buffers.push_back(buffer);
+
+        threadBuffer.retired = &buffer->retired;
+        threadBuffer.buffer = std::move(buffer);
+    }
+
+    return *static_cast<ThreadBuffer*>(threadBuffer.buffer.get());
+}
+
 /**
  *
- */
\ No newline at end of file
+ */
+void EclipseLogger::Run()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    while (_running.load(std::memory_order_acquire))
+    {
+        _condition.wait_for(lock, std::chrono::milliseconds(DRAIN_INTERVAL));
+
+        lock.unlock();
+        Drain();
+        lock.lock();
+    }
+}
+
+/**
+ * Order is kept per thread, lines of different threads may interleave by up to a drain interval.
+ * The lock only covers copying the buffer list, new threads never wait on the core logger.
+ */
+void EclipseLogger::Drain()
+{
+    {
+        std::lock_guard<std::mutex> guard(_buffersLock);
+        _draining = _buffers;
+    }
+
+    bool released = false;
+    EclipseLogRecord record;
+    for (const std::shared_ptr<ThreadBuffer>& buffer : _draining)
+    {
+        // Checked before draining, a retired buffer receives nothing afterwards
+        bool retired = buffer->retired.load(std::memory_order_acquire);
+        while (buffer->Pop(record))
+            sLog->outMessage(ECLIPSE_LOG_FILTER, record.level, "{}", record.message);
+
+        if (retired)
+            released = buffer->released = true;
+    }
+
+    _draining.clear();
+    if (released)
+    {
+        std::lock_guard<std::mutex> guard(_buffersLock);
+        std::erase_if(_buffers, [](const std::shared_ptr<ThreadBuffer>& buffer) { return buffer->released; });
+    }
+
+    uint64 dropped = _dropped.load(std::memory_order_relaxed);
+    if (dropped != _reportedDropped)
+    {
+        sLog->outMessage(ECLIPSE_LOG_FILTER, LOG_LEVEL_WARN, "[Eclipse]: Dropped {} log lines, the log buffers were full", dropped - _reportedDropped);
+        _reportedDropped = dropped;
+    }
+}
+
+EclipseLogger::ThreadBuffer::ThreadBuffer(std::size_t capacity) :
+_records(std::make_unique<EclipseLogRecord[]>(std::bit_ceil(capacity))),
+_mask(std::bit_ceil(capacity) - 1)
+{
+}
+
+/**
+ *
+ */
+bool EclipseLogger::ThreadBuffer::Push(EclipseLogRecord&& record)
+{
+    std::size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) > _mask)
+        return false;
+
+    _records[tail & _mask] = std::move(record);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ *
+ */
+bool EclipseLogger::ThreadBuffer::Pop(EclipseLogRecord& record)
+{
+    std::size_t head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire))
+        return false;
+
+    record = std::move(_records[head & _mask]);
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * A limit of 0 lets everything through
+ */
+bool EclipseLogRateLimiter::Allow(const std::string& script)
+{
+    if (!_limit)
+        return true;
+
+    auto now = std::chrono::steady_clock::now();
+    auto [it, inserted] = _buckets.try_emplace(script, Bucket{ static_cast<double>(_limit), now });
+    Bucket& bucket = it->second;
+
+    std::chrono::duration<double> elapsed = now - bucket.refilled;
+    bucket.tokens = std::min<double>(_limit, bucket.tokens + elapsed.count() * _limit);
+    bucket.refilled = now;
+
+    if (bucket.tokens < 1.0)
+    {
+        ++bucket.suppressed;
+        EclipseMetrics::GetInstance().Increment(METRIC_LOG_LINES_DROPPED);
+        return false;
+    }
+
+    bucket.tokens -= 1.0;
+    if (bucket.suppressed)
+    {
+        ECLIPSE_LOG_WARN("[Eclipse]: Suppressed {} log lines from `{}`, it logs more than {} lines per second", bucket.suppressed, script, _limit);
+        bucket.suppressed = 0;
+    }
+
+    return true;
+}
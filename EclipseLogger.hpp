@@ -9,24 +9,123 @@
 
 #include "Log.h"
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define ECLIPSE_LOG_FILTER "server.eclipse"
+
+struct EclipseLogRecord
+{
+    LogLevel level = LOG_LEVEL_INFO;
+    std::string message;
+};
+
+// Messages are formatted by the caller and pushed to a ring owned by the calling thread, a
+// background thread drains every ring into the core logger. A full ring drops the message,
+// writing never blocks a map update. While stopped messages go to the core logger directly.
 class EclipseLogger
 {
     public:
+        static constexpr std::size_t DEFAULT_BUFFER_SIZE = 4096;
+        static constexpr uint32 DRAIN_INTERVAL = 10; // milliseconds
+
         static EclipseLogger& GetInstance();
 
+        void Start(std::size_t bufferSize = DEFAULT_BUFFER_SIZE);
+        void Stop();
+        bool IsRunning() const { return _running.load(std::memory_order_acquire); }
+
+        void Write(LogLevel level, std::string&& message);
+
+        uint64 GetDroppedCount() const { return _dropped.load(std::memory_order_relaxed); }
+
     private:
         EclipseLogger() = default;
-        ~EclipseLogger() = default;
+        ~EclipseLogger();
         EclipseLogger(const EclipseLogger&) = delete;
         EclipseLogger& operator=(const EclipseLogger&) = delete;
+
+        // Single producer (the owning thread), single consumer (the drain thread)
+        class ThreadBuffer
+        {
+            public:
+                explicit ThreadBuffer(std::size_t capacity);
+
+                bool Push(EclipseLogRecord&& record);
+                bool Pop(EclipseLogRecord& record);
+
+                // Set by the producer around a push, Stop waits for it before the last drain
+                void SetWriting(bool writing) { _writing.store(writing); }
+                bool IsWriting() const { return _writing.load(); }
+
+                std::atomic<bool> retired{ false };
+                bool released = false; // drained after retiring, only touched by the consumer
+
+            private:
+                std::unique_ptr<EclipseLogRecord[]> _records;
+                std::size_t _mask;
+
+                alignas(64) std::atomic<std::size_t> _head{ 0 };
+                alignas(64) std::atomic<std::size_t> _tail{ 0 };
+                std::atomic<bool> _writing{ false };
+        };
+
+        ThreadBuffer& GetThreadBuffer();
+        void Run();
+        void Drain();
+
+        std::vector<std::shared_ptr<ThreadBuffer>> _buffers;
+        std::vector<std::shared_ptr<ThreadBuffer>> _draining; // copy of _buffers owned by the consumer
+        std::mutex _buffersLock;
+        std::size_t _bufferSize = DEFAULT_BUFFER_SIZE;
+
+        std::thread _thread;
+        std::mutex _lock;
+        std::condition_variable _condition;
+        std::atomic<bool> _running{ false };
+
+        std::atomic<uint64> _dropped{ 0 };
+        uint64 _reportedDropped = 0;
+};
+
+// Token bucket per script for lines logged from Lua, owned by a single state.
+// Suppressed lines are counted and reported once the script is allowed to log again.
+class EclipseLogRateLimiter
+{
+    public:
+        void SetLimit(uint32 linesPerSecond) { _limit = linesPerSecond; }
+        bool Allow(const std::string& script);
+
+    private:
+        struct Bucket
+        {
+            double tokens;
+            std::chrono::steady_clock::time_point refilled;
+            uint64 suppressed = 0;
+        };
+
+        uint32 _limit = 0;
+        std::unordered_map<std::string, Bucket> _buckets;
 };
 
-#define ECLIPSE_LOG_INFO(...)     LOG_INFO("server.eclipse", __VA_ARGS__);
-#define ECLIPSE_LOG_WARN(...)     LOG_WARN("server.eclipse", __VA_ARGS__);
-#define ECLIPSE_LOG_ERROR(...)    LOG_ERROR("server.eclipse", __VA_ARGS__);
-#define ECLIPSE_LOG_DEBUG(...)    LOG_DEBUG("server.eclipse", __VA_ARGS__);
-#define ECLIPSE_LOG_TRACE(...)    LOG_TRACE("server.eclipse", __VA_ARGS__);
+#define ECLIPSE_LOG_MESSAGE(level__, ...)                                                       \
+        do {                                                                                    \
+            if (sLog->ShouldLog(ECLIPSE_LOG_FILTER, level__))                                   \
+                EclipseLogger::GetInstance().Write(level__, Acore::StringFormat(__VA_ARGS__));  \
+        } while (0)
 
+#define ECLIPSE_LOG_INFO(...)     ECLIPSE_LOG_MESSAGE(LOG_LEVEL_INFO, __VA_ARGS__);
+#define ECLIPSE_LOG_WARN(...)     ECLIPSE_LOG_MESSAGE(LOG_LEVEL_WARN, __VA_ARGS__);
+#define ECLIPSE_LOG_ERROR(...)    ECLIPSE_LOG_MESSAGE(LOG_LEVEL_ERROR, __VA_ARGS__);
+#define ECLIPSE_LOG_DEBUG(...)    ECLIPSE_LOG_MESSAGE(LOG_LEVEL_DEBUG, __VA_ARGS__);
+#define ECLIPSE_LOG_TRACE(...)    ECLIPSE_LOG_MESSAGE(LOG_LEVEL_TRACE, __VA_ARGS__);
 
-#endif // ECLIPSE_LOGGER_HPP
 
+#endif // ECLIPSE_LOGGER_HPP
@@ -0,0 +1,323 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseMessaging.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace
+{
+    // Handed to ReadMessage through a light userdata
+    struct DeserializeCall
+    {
+        std::string_view buffer;
+        bool valid;
+    };
+
+    enum MessageValueTag : uint8
+    {
+        TAG_NIL,
+        TAG_FALSE,
+        TAG_TRUE,
+        TAG_INTEGER,
+        TAG_NUMBER,
+        TAG_STRING,
+        TAG_TABLE,
+        TAG_TABLE_END
+    };
+
+    void WriteVarint(std::string& buffer, uint64 value)
+    {
+        while (value >= 0x80)
+        {
+            buffer.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+
+        buffer.push_back(static_cast<char>(value));
+    }
+
+    bool ReadVarint(std::string_view buffer, std::size_t& offset, uint64& value)
+    {
+        value = 0;
+        for (uint32 shift = 0; shift < 64 && offset < buffer.size(); shift += 7)
+        {
+            uint8 byte = static_cast<uint8>(buffer[offset++]);
+            value |= static_cast<uint64>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+
+        return false;
+    }
+}
+
+EclipseMessageQueue::EclipseMessageQueue(std::size_t capacity) :
+_cells(std::make_unique<Cell[]>(std::bit_ceil(std::max<std::size_t>(capacity, 2)))),
+_mask(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+_enqueuePos(0),
+_dequeuePos(0),
+_dropped(0)
+{
+    for (std::size_t i = 0; i <= _mask; ++i)
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+/**
+ * Producers claim a position with a CAS and publish the cell through its sequence
+ */
+bool EclipseMessageQueue::Push(EclipseMessage&& message)
+{
+    Cell* cell;
+    std::size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        cell = &_cells[pos & _mask];
+        std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+        if (!difference)
+        {
+            if (_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (difference < 0)
+        {
+            // The consumer has not released the cell from the previous lap yet
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+            pos = _enqueuePos.load(std::memory_order_relaxed);
+    }
+
+    cell->message = std::move(message);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+/**
+ * Single consumer, the dequeue position needs no synchronization
+ */
+bool EclipseMessageQueue::Pop(EclipseMessage& message)
+{
+    Cell& cell = _cells[_dequeuePos & _mask];
+    if (cell.sequence.load(std::memory_order_acquire) != _dequeuePos + 1)
+        return false;
+
+    message = std::move(cell.message);
+    cell.sequence.store(_dequeuePos + _mask + 1, std::memory_order_release);
+    ++_dequeuePos;
+    return true;
+}
+
+/**
+ *
+ */
+bool EclipseMessageSerializer::Serialize(lua_State* L, int index, std::string& buffer, std::string& error)
+{
+    buffer.clear();
+    return WriteValue(L, index, 0, buffer, error);
+}
+
+/**
+ * Pushes the value on success, leaves the stack untouched otherwise
+ */
+bool EclipseMessageSerializer::Deserialize(lua_State* L, std::string_view buffer, std::string& error)
+{
+    int top = lua_gettop(L);
+    if (!lua_checkstack(L, 2))
+    {
+        error = "stack overflow";
+        return false;
+    }
+
+    DeserializeCall call{ buffer, false };
+    lua_pushcfunction(L, &EclipseMessageSerializer::ReadMessage);
+    lua_pushlightuserdata(L, &call);
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK)
+    {
+        const char* message = lua_tostring(L, -1);
+        error = message ? message : "error object is not a string";
+        lua_settop(L, top);
+        return false;
+    }
+
+    if (!call.valid)
+    {
+        error = "malformed payload";
+        lua_settop(L, top);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Runs under lua_pcall, a table or string that cannot be allocated raises right through here
+ */
+int EclipseMessageSerializer::ReadMessage(lua_State* L)
+{
+    DeserializeCall* call = static_cast<DeserializeCall*>(lua_touserdata(L, 1));
+    std::size_t offset = 0;
+    call->valid = ReadValue(L, call->buffer, offset, 0) && offset == call->buffer.size();
+    return call->valid ? 1 : 0;
+}
+
+/**
+ *
+ */
+bool EclipseMessageSerializer::WriteValue(lua_State* L, int index, uint32 depth, std::string& buffer, std::string& error)
+{
+    if (index < 0)
+        index = lua_gettop(L) + index + 1;
+
+    int type = lua_type(L, index);
+    switch (type)
+    {
+        case LUA_TNIL:
+            buffer.push_back(TAG_NIL);
+            return true;
+        case LUA_TBOOLEAN:
+            buffer.push_back(lua_toboolean(L, index) ? TAG_TRUE : TAG_FALSE);
+            return true;
+        case LUA_TNUMBER:
+        {
+#ifndef SOL_LUAJIT
+            if (lua_isinteger(L, index))
+            {
+                int64 value = lua_tointeger(L, index);
+                buffer.push_back(TAG_INTEGER);
+                WriteVarint(buffer, (static_cast<uint64>(value) << 1) ^ static_cast<uint64>(value >> 63));
+                return true;
+            }
+#endif
+            double value = lua_tonumber(L, index);
+            char bytes[sizeof(double)];
+            std::memcpy(bytes, &value, sizeof(double));
+            buffer.push_back(TAG_NUMBER);
+            buffer.append(bytes, sizeof(double));
+            return true;
+        }
+        case LUA_TSTRING:
+        {
+            std::size_t length = 0;
+            const char* value = lua_tolstring(L, index, &length);
+            buffer.push_back(TAG_STRING);
+            WriteVarint(buffer, length);
+            buffer.append(value, length);
+            return true;
+        }
+        case LUA_TTABLE:
+        {
+            // Cycles end up here as well
+            if (depth >= MAX_DEPTH)
+            {
+                error = "tables nested deeper than " + std::to_string(MAX_DEPTH) + " levels cannot be sent";
+                return false;
+            }
+
+            if (!lua_checkstack(L, 2))
+            {
+                error = "out of stack space";
+                return false;
+            }
+
+            buffer.push_back(TAG_TABLE);
+            lua_pushnil(L);
+            while (lua_next(L, index))
+            {
+                if (!WriteValue(L, -2, depth + 1, buffer, error) || !WriteValue(L, -1, depth + 1, buffer, error))
+                {
+                    lua_pop(L, 2);
+                    return false;
+                }
+                lua_pop(L, 1);
+            }
+            buffer.push_back(TAG_TABLE_END);
+            return true;
+        }
+        default:
+            error = std::string("values of type ") + lua_typename(L, type) + " cannot be sent";
+            return false;
+    }
+}
+
+/**
+ * Buffers come from other threads' serializers, they are still bounds checked
+ */
+bool EclipseMessageSerializer::ReadValue(lua_State* L, std::string_view buffer, std::size_t& offset, uint32 depth)
+{
+    if (offset >= buffer.size() || !lua_checkstack(L, 3))
+        return false;
+
+    switch (static_cast<uint8>(buffer[offset++]))
+    {
+        case TAG_NIL:
+            lua_pushnil(L);
+            return true;
+        case TAG_FALSE:
+            lua_pushboolean(L, 0);
+            return true;
+        case TAG_TRUE:
+            lua_pushboolean(L, 1);
+            return true;
+        case TAG_INTEGER:
+        {
+            uint64 value;
+            if (!ReadVarint(buffer, offset, value))
+                return false;
+
+            lua_pushinteger(L, static_cast<lua_Integer>((value >> 1) ^ (~(value & 1) + 1)));
+            return true;
+        }
+        case TAG_NUMBER:
+        {
+            if (buffer.size() - offset < sizeof(double))
+                return false;
+
+            double value;
+            std::memcpy(&value, buffer.data() + offset, sizeof(double));
+            offset += sizeof(double);
+            lua_pushnumber(L, value);
+            return true;
+        }
+        case TAG_STRING:
+        {
+            uint64 length;
+            if (!ReadVarint(buffer, offset, length) || buffer.size() - offset < length)
+                return false;
+
+            lua_pushlstring(L, buffer.data() + offset, length);
+            offset += length;
+            return true;
+        }
+        case TAG_TABLE:
+        {
+            if (depth >= MAX_DEPTH)
+                return false;
+
+            lua_newtable(L);
+            while (offset < buffer.size() && static_cast<uint8>(buffer[offset]) != TAG_TABLE_END)
+            {
+                if (!ReadValue(L, buffer, offset, depth + 1) || !ReadValue(L, buffer, offset, depth + 1))
+                    return false;
+
+                // rawset raises on nil and NaN keys, neither comes out of a valid buffer
+                if (lua_isnil(L, -2) || (lua_type(L, -2) == LUA_TNUMBER && lua_tonumber(L, -2) != lua_tonumber(L, -2)))
+                    return false;
+
+                lua_rawset(L, -3);
+            }
+
+            return offset++ < buffer.size();
+        }
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_MESSAGING_HPP
+#define ECLIPSE_MESSAGING_HPP
+
+#include "EclipseIncludes.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Payloads are immutable once serialized, a broadcast shares one buffer between all receivers
+struct EclipseMessage
+{
+    int32 sender = -1;
+    uint32 senderInstance = 0;
+    std::string channel;
+    std::shared_ptr<const std::string> payload;
+};
+
+// Bounded multi producer, single consumer ring. Any thread pushes without locking, only the thread
+// updating the owning state pops. A full queue rejects the message instead of blocking the sender.
+class EclipseMessageQueue
+{
+    public:
+        static constexpr std::size_t DEFAULT_CAPACITY = 1024;
+
+        explicit EclipseMessageQueue(std::size_t capacity = DEFAULT_CAPACITY);
+
+        bool Push(EclipseMessage&& message);
+        bool Pop(EclipseMessage& message);
+
+        std::size_t GetCapacity() const { return _mask + 1; }
+        uint64 GetDroppedCount() const { return _dropped.load(std::memory_order_relaxed); }
+
+    private:
+        EclipseMessageQueue(const EclipseMessageQueue&) = delete;
+        EclipseMessageQueue& operator=(const EclipseMessageQueue&) = delete;
+
+        // The sequence tells producers and the consumer whose turn the cell is
+        struct alignas(64) Cell
+        {
+            std::atomic<std::size_t> sequence;
+            EclipseMessage message;
+        };
+
+        std::unique_ptr<Cell[]> _cells;
+        std::size_t _mask;
+
+        alignas(64) std::atomic<std::size_t> _enqueuePos;
+        alignas(64) std::size_t _dequeuePos;
+        std::atomic<uint64> _dropped;
+};
+
+// Compact binary form of Lua values: nil, booleans, numbers, strings and tables of those.
+// Functions, userdata, threads and cyclic or too deeply nested tables cannot be sent.
+class EclipseMessageSerializer
+{
+    public:
+        static constexpr uint32 MAX_DEPTH = 16;
+
+        static bool Serialize(lua_State* L, int index, std::string& buffer, std::string& error);
+        // Decodes under lua_pcall, a memory error is reported through `error` like a malformed buffer
+        static bool Deserialize(lua_State* L, std::string_view buffer, std::string& error);
+
+    private:
+        EclipseMessageSerializer() = delete;
+
+        static bool WriteValue(lua_State* L, int index, uint32 depth, std::string& buffer, std::string& error);
+        static bool ReadValue(lua_State* L, std::string_view buffer, std::size_t& offset, uint32 depth);
+        static int ReadMessage(lua_State* L);
+};
+
+#endif // ECLIPSE_MESSAGING_HPP
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseMetrics.hpp"
+#include "EclipseStateManager.hpp"
+
+#include <bit>
+#include <sstream>
+
+namespace
+{
+    // Hands the shard back when its thread exits, compiler workers come and go on every reload
+    struct ShardHandle
+    {
+        void* shard = nullptr;
+        std::atomic<bool>* inUse = nullptr;
+
+        ~ShardHandle()
+        {
+            if (inUse)
+                inUse->store(false, std::memory_order_release);
+        }
+    };
+
+    thread_local ShardHandle localShard;
+
+    constexpr char const* COUNTER_NAMES[METRIC_COUNTER_COUNT] =
+    {
+        "cache_hits",
+        "cache_misses",
+        "cache_invalidations",
+        "scripts_compiled",
+        "scripts_up_to_date",
+        "compile_errors",
+        "scripts_executed",
+        "script_errors",
+        "requires_resolved",
+        "requires_unresolved",
+        "states_created",
+        "states_destroyed",
+        "timers_fired",
+        "messages_sent",
+        "messages_dropped",
+        "gc_cycles",
+        "log_lines_dropped",
+        "budgets_exceeded"
+    };
+
+    constexpr char const* HISTOGRAM_NAMES[METRIC_HISTOGRAM_COUNT] =
+    {
+        "compile_time_us",
+        "state_run_time_us",
+        "state_reload_time_us",
+        "gc_step_time_us"
+    };
+}
+
+/**
+ *
+ */
+uint8 MetricHistogram::GetBucket(uint64 value)
+{
+    return static_cast<uint8>(std::min<int>(std::bit_width(value), METRIC_HISTOGRAM_BUCKETS - 1));
+}
+
+/**
+ *
+ */
+uint64 MetricHistogram::GetBucketUpperBound(uint8 bucket)
+{
+    return bucket ? (uint64(1) << bucket) - 1 : 0;
+}
+
+/**
+ * Estimated as the upper bound of the bucket holding the percentile
+ */
+uint64 MetricHistogram::GetPercentile(double percentile) const
+{
+    if (!count)
+        return 0;
+
+    uint64 rank = static_cast<uint64>(percentile / 100.0 * static_cast<double>(count));
+    uint64 seen = 0;
+    for (uint8 bucket = 0; bucket < METRIC_HISTOGRAM_BUCKETS; ++bucket)
+    {
+        seen += buckets[bucket];
+        if (seen > rank)
+            return GetBucketUpperBound(bucket);
+    }
+
+    return GetBucketUpperBound(METRIC_HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ *
+ */
+EclipseMetrics& EclipseMetrics::GetInstance()
+{
+    static EclipseMetrics instance;
+    return instance;
+}
+
+/**
+ *
+ */
+EclipseMetrics::Shard& EclipseMetrics::GetLocalShard()
+{
+    if (!localShard.shard)
+    {
+        Shard* shard = AcquireShard();
+        localShard.shard = shard;
+        localShard.inUse = &shard->inUse;
+    }
+
+    return *static_cast<Shard*>(localShard.shard);
+}
+
+/**
+ * Shards are never freed, a released one keeps its totals and is reused by the next thread
+ */
+EclipseMetrics::Shard* EclipseMetrics::AcquireShard()
+{
+    std::lock_guard<std::mutex> guard(_shardsLock);
+
+    for (auto& shard : _shards)
+    {
+        bool expected = false;
+        if (shard->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire))
+            return shard.get();
+    }
+
+    Shard* shard = _shards.emplace_back(std::make_unique<Shard>()).get();
+    shard->inUse.store(true, std::memory_order_relaxed);
+    return shard;
+}
+
+/**
+ *
+ */
+MetricsTotals EclipseMetrics::CollectRaw() const
+{
+    MetricsTotals totals;
+    for (const auto& shard : _shards)
+    {
+        for (uint8 counter = 0; counter < METRIC_COUNTER_COUNT; ++counter)
+            totals.counters[counter] += shard->counters[counter].load(std::memory_order_relaxed);
+
+        for (uint8 histogram = 0; histogram < METRIC_HISTOGRAM_COUNT; ++histogram)
+        {
+            MetricHistogram& total = totals.histograms[histogram];
+            for (uint8 bucket = 0; bucket < METRIC_HISTOGRAM_BUCKETS; ++bucket)
+            {
+                uint64 samples = shard->buckets[histogram][bucket].load(std::memory_order_relaxed);
+                total.buckets[bucket] += samples;
+                total.count += samples;
+            }
+
+            total.sum += shard->sums[histogram].load(std::memory_order_relaxed);
+        }
+    }
+
+    return totals;
+}
+
+/**
+ * Totals since the last reset
+ */
+MetricsTotals EclipseMetrics::Collect() const
+{
+    std::lock_guard<std::mutex> guard(_shardsLock);
+
+    MetricsTotals totals = CollectRaw();
+    for (uint8 counter = 0; counter < METRIC_COUNTER_COUNT; ++counter)
+        totals.counters[counter] -= std::min(totals.counters[counter], _baseline.counters[counter]);
+
+    for (uint8 histogram = 0; histogram < METRIC_HISTOGRAM_COUNT; ++histogram)
+    {
+        MetricHistogram& total = totals.histograms[histogram];
+        const MetricHistogram& baseline = _baseline.histograms[histogram];
+        total.count -= std::min(total.count, baseline.count);
+        total.sum -= std::min(total.sum, baseline.sum);
+        for (uint8 bucket = 0; bucket < METRIC_HISTOGRAM_BUCKETS; ++bucket)
+            total.buckets[bucket] -= std::min(total.buckets[bucket], baseline.buckets[bucket]);
+    }
+
+    return totals;
+}
+
+/**
+ *
+ */
+uint64 EclipseMetrics::GetCounter(EclipseCounter counter) const
+{
+    return Collect().counters[counter];
+}
+
+/**
+ *
+ */
+MetricHistogram EclipseMetrics::GetHistogram(EclipseHistogram histogram) const
+{
+    return Collect().histograms[histogram];
+}
+
+/**
+ * Shards only accept writes from their own thread, a reset moves the baseline instead
+ */
+void EclipseMetrics::Reset()
+{
+    std::lock_guard<std::mutex> guard(_shardsLock);
+    _baseline = CollectRaw();
+}
+
+/**
+ *
+ */
+std::vector<std::string> EclipseMetrics::GetReport() const
+{
+    MetricsTotals totals = Collect();
+    std::vector<std::string> report;
+
+    for (uint8 counter = 0; counter < METRIC_COUNTER_COUNT; ++counter)
+        report.push_back(std::string(COUNTER_NAMES[counter]) + ": " + std::to_string(totals.counters[counter]));
+
+    for (uint8 histogram = 0; histogram < METRIC_HISTOGRAM_COUNT; ++histogram)
+    {
+        const MetricHistogram& values = totals.histograms[histogram];
+
+        std::ostringstream line;
+        line << HISTOGRAM_NAMES[histogram] << ": count " << values.count << ", mean " << values.GetMean()
+             << ", p50 " << values.GetPercentile(50.0) << ", p99 " << values.GetPercentile(99.0);
+        report.push_back(line.str());
+    }
+
+    const EclipseStateManager& stateManager = EclipseStateManager::GetInstance();
+    report.push_back("states: " + std::to_string(stateManager.GetStateCount()));
+
+    stateManager.ForEachState([&report](int32 mapId, uint32 instanceId, const EclipseSolState& state)
+    {
+        const EclipseStateStats& stats = state.GetStats();
+
+        std::ostringstream line;
+        line << "state " << mapId << ":" << instanceId << ": heap " << stats.memoryUsage.load(std::memory_order_relaxed) << " bytes";
+        if (uint64 peakMemory = stats.peakMemory.load(std::memory_order_relaxed))
+            line << " (peak " << peakMemory << ")";
+
+        line << ", last run " << stats.lastRunTime.load(std::memory_order_relaxed) << " µs";
+
+        EclipseGCMode gcMode = static_cast<EclipseGCMode>(stats.gcMode.load(std::memory_order_relaxed));
+        line << ", gc " << EclipseGarbageCollector::GetModeName(gcMode);
+        if (gcMode == GC_MODE_STEPPED)
+            line << " (step " << stats.gcStepSize.load(std::memory_order_relaxed) << " KB)";
+
+        const EclipseExecutionBudget& budget = state.GetBudget();
+        if (budget.GetExceededCount())
+            line << ", budget exceeded " << budget.GetExceededCount() << " times (last by `" << budget.GetLastOffender() << "`)";
+        report.push_back(line.str());
+    });
+
+    return report;
+}
+
+/**
+ *
+ */
+const char* EclipseMetrics::GetCounterName(EclipseCounter counter)
+{
+    return counter < METRIC_COUNTER_COUNT ? COUNTER_NAMES[counter] : "unknown";
+}
+
+/**
+ *
+ */
+const char* EclipseMetrics::GetHistogramName(EclipseHistogram histogram)
+{
+    return histogram < METRIC_HISTOGRAM_COUNT ? HISTOGRAM_NAMES[histogram] : "unknown";
+}
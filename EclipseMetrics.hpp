@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_METRICS_HPP
+#define ECLIPSE_METRICS_HPP
+
+#include "Common.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+enum EclipseCounter : uint8
+{
+    METRIC_CACHE_HITS,
+    METRIC_CACHE_MISSES,
+    METRIC_CACHE_INVALIDATIONS,
+    METRIC_SCRIPTS_COMPILED,
+    METRIC_SCRIPTS_UP_TO_DATE,
+    METRIC_COMPILE_ERRORS,
+    METRIC_SCRIPTS_EXECUTED,
+    METRIC_SCRIPT_ERRORS,
+    METRIC_REQUIRES_RESOLVED,
+    METRIC_REQUIRES_UNRESOLVED,
+    METRIC_STATES_CREATED,
+    METRIC_STATES_DESTROYED,
+    METRIC_TIMERS_FIRED,
+    METRIC_MESSAGES_SENT,
+    METRIC_MESSAGES_DROPPED,
+    METRIC_GC_CYCLES,
+    METRIC_LOG_LINES_DROPPED,
+    METRIC_BUDGETS_EXCEEDED,
+
+    METRIC_COUNTER_COUNT
+};
+
+// Latencies, all recorded in microseconds
+enum EclipseHistogram : uint8
+{
+    METRIC_COMPILE_TIME,
+    METRIC_STATE_RUN_TIME,
+    METRIC_STATE_RELOAD_TIME,
+    METRIC_GC_STEP_TIME,
+
+    METRIC_HISTOGRAM_COUNT
+};
+
+// Bucket i holds values of bit width i, [2^(i-1), 2^i - 1], the last one everything above
+constexpr uint8 METRIC_HISTOGRAM_BUCKETS = 32;
+
+struct MetricHistogram
+{
+    uint64 count = 0;
+    uint64 sum = 0;
+    std::array<uint64, METRIC_HISTOGRAM_BUCKETS> buckets{};
+
+    uint64 GetMean() const { return count ? sum / count : 0; }
+    uint64 GetPercentile(double percentile) const;
+
+    static uint8 GetBucket(uint64 value);
+    static uint64 GetBucketUpperBound(uint8 bucket);
+};
+
+struct MetricsTotals
+{
+    std::array<uint64, METRIC_COUNTER_COUNT> counters{};
+    std::array<MetricHistogram, METRIC_HISTOGRAM_COUNT> histograms{};
+};
+
+class EclipseMetrics
+{
+    public:
+        static EclipseMetrics& GetInstance();
+
+        // Called from any thread, only touches the calling thread's shard
+        void Increment(EclipseCounter counter, uint64 value = 1)
+        {
+            Add(GetLocalShard().counters[counter], value);
+        }
+
+        void Record(EclipseHistogram histogram, uint64 value)
+        {
+            Shard& shard = GetLocalShard();
+            Add(shard.buckets[histogram][MetricHistogram::GetBucket(value)], 1);
+            Add(shard.sums[histogram], value);
+        }
+
+        uint64 GetCounter(EclipseCounter counter) const;
+        MetricHistogram GetHistogram(EclipseHistogram histogram) const;
+        MetricsTotals Collect() const;
+        void Reset();
+
+        // Lines for the metrics GM command, engine totals followed by every live state
+        std::vector<std::string> GetReport() const;
+
+        static const char* GetCounterName(EclipseCounter counter);
+        static const char* GetHistogramName(EclipseHistogram histogram);
+
+    private:
+        EclipseMetrics() = default;
+        ~EclipseMetrics() = default;
+        EclipseMetrics(const EclipseMetrics&) = delete;
+        EclipseMetrics& operator=(const EclipseMetrics&) = delete;
+
+        // Written by a single thread, readers sum every shard
+        struct alignas(64) Shard
+        {
+            std::array<std::atomic<uint64>, METRIC_COUNTER_COUNT> counters{};
+            std::array<std::array<std::atomic<uint64>, METRIC_HISTOGRAM_BUCKETS>, METRIC_HISTOGRAM_COUNT> buckets{};
+            std::array<std::atomic<uint64>, METRIC_HISTOGRAM_COUNT> sums{};
+            std::atomic<bool> inUse{ false };
+        };
+
+        static void Add(std::atomic<uint64>& value, uint64 amount)
+        {
+            // Single writer, a plain store avoids the locked read-modify-write
+            value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        Shard& GetLocalShard();
+        Shard* AcquireShard();
+        MetricsTotals CollectRaw() const;
+
+        mutable std::mutex _shardsLock;
+        std::vector<std::unique_ptr<Shard>> _shards;
+        MetricsTotals _baseline;
+};
+
+class EclipseMetricTimer
+{
+    public:
+        explicit EclipseMetricTimer(EclipseHistogram histogram) :
+        _histogram(histogram),
+        _startTime(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~EclipseMetricTimer()
+        {
+            EclipseMetrics::GetInstance().Record(_histogram, GetElapsed());
+        }
+
+        uint64 GetElapsed() const
+        {
+            return static_cast<uint64>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - _startTime).count());
+        }
+
+    private:
+        EclipseHistogram _histogram;
+        std::chrono::steady_clock::time_point _startTime;
+};
+
+#endif // ECLIPSE_METRICS_HPP
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseProfiler.hpp"
+#include "EclipseLogger.hpp"
+
+#include <array>
+#include <fstream>
+
+EclipseProfiler::~EclipseProfiler()
+{
+    Stop();
+}
+
+/**
+ *
+ */
+bool EclipseProfiler::Start(EclipseHook& hook, uint32 instructionPeriod, uint32 sampleIntervalUs)
+{
+    if (IsRunning() || !hook.IsAttached())
+        return false;
+
+    _hook = &hook;
+    _sampleInterval = std::chrono::microseconds(sampleIntervalUs);
+    _nextSample = std::chrono::steady_clock::now() + _sampleInterval;
+
+    _hook->SetClient(HOOK_CLIENT_PROFILER, instructionPeriod, &EclipseProfiler::Hook, this);
+    return true;
+}
+
+/**
+ *
+ */
+void EclipseProfiler::Stop()
+{
+    if (!IsRunning())
+        return;
+
+    _hook->ClearClient(HOOK_CLIENT_PROFILER);
+    _hook = nullptr;
+}
+
+/**
+ *
+ */
+void EclipseProfiler::Reset()
+{
+    _stacks.clear();
+    _sampleCount = 0;
+}
+
+/**
+ *
+ */
+void EclipseProfiler::Hook(void* owner, lua_State* L)
+{
+    static_cast<EclipseProfiler*>(owner)->Sample(L);
+}
+
+/**
+ *
+ */
+void EclipseProfiler::Sample(lua_State* L)
+{
+    if (_sampleInterval.count())
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now < _nextSample)
+            return;
+
+        _nextSample = now + _sampleInterval;
+    }
+
+    std::array<lua_Debug, MAX_STACK_DEPTH> frames;
+    uint32 depth = 0;
+    while (depth < MAX_STACK_DEPTH && lua_getstack(L, depth, &frames[depth]))
+        ++depth;
+
+    // Collapsed stacks go from the outermost frame to the one being executed
+    _stackBuffer.clear();
+    for (uint32 i = depth; i-- > 0;)
+    {
+        lua_Debug& frame = frames[i];
+        if (!lua_getinfo(L, "Sn", &frame))
+            continue;
+
+        if (!_stackBuffer.empty())
+            _stackBuffer += ';';
+
+        _stackBuffer += frame.short_src;
+        _stackBuffer += ':';
+        _stackBuffer += frame.name ? frame.name : (*frame.what == 'm' ? "main" : "?");
+        if (frame.linedefined > 0)
+        {
+            _stackBuffer += ':';
+            _stackBuffer += std::to_string(frame.linedefined);
+        }
+    }
+
+    if (_stackBuffer.empty())
+        return;
+
+    auto it = _stacks.find(_stackBuffer);
+    if (it != _stacks.end())
+        ++it->second;
+    else
+        _stacks.emplace(_stackBuffer, 1);
+
+    ++_sampleCount;
+}
+
+/**
+ *
+ */
+std::string EclipseProfiler::GetCollapsedStacks() const
+{
+    std::string output;
+    for (const auto& [stack, count] : _stacks)
+    {
+        output += stack;
+        output += ' ';
+        output += std::to_string(count);
+        output += '\n';
+    }
+    return output;
+}
+
+/**
+ *
+ */
+bool EclipseProfiler::Dump(const std::string& filePath) const
+{
+    std::ofstream file(filePath, std::ios::trunc);
+    if (!file)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Unable to write profile to `{}`", filePath);
+        return false;
+    }
+
+    file << GetCollapsedStacks();
+    ECLIPSE_LOG_INFO("[Eclipse]: Wrote {} samples ({} unique stacks) to `{}`", _sampleCount, _stacks.size(), filePath);
+    return true;
+}
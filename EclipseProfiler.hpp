@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_PROFILER_HPP
+#define ECLIPSE_PROFILER_HPP
+
+#include "EclipseIncludes.hpp"
+#include "EclipseHook.hpp"
+
+// Sampling profiler for one Lua state. It is a client of the state's count hook while profiling, stacks are
+// aggregated per file/function and dumped as collapsed stacks ("a;b;c count") for flame graphs.
+class EclipseProfiler
+{
+    public:
+        static constexpr uint32 DEFAULT_INSTRUCTION_PERIOD = 10000;
+        static constexpr uint32 MAX_STACK_DEPTH = 64;
+
+        EclipseProfiler() = default;
+        ~EclipseProfiler();
+
+        // With a sample interval, the count hook only samples once that much time has passed
+        bool Start(EclipseHook& hook, uint32 instructionPeriod = DEFAULT_INSTRUCTION_PERIOD, uint32 sampleIntervalUs = 0);
+        void Stop();
+        void Reset();
+
+        bool IsRunning() const { return _hook != nullptr; }
+        uint64 GetSampleCount() const { return _sampleCount; }
+
+        std::string GetCollapsedStacks() const;
+        bool Dump(const std::string& filePath) const;
+
+    private:
+        EclipseProfiler(const EclipseProfiler&) = delete;
+        EclipseProfiler& operator=(const EclipseProfiler&) = delete;
+
+        static void Hook(void* owner, lua_State* L);
+        void Sample(lua_State* L);
+
+        EclipseHook* _hook = nullptr;
+        std::chrono::microseconds _sampleInterval{ 0 };
+        std::chrono::steady_clock::time_point _nextSample;
+
+        std::unordered_map<std::string, uint64> _stacks;
+        std::string _stackBuffer;
+        uint64 _sampleCount = 0;
+};
+
+#endif // ECLIPSE_PROFILER_HPP
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseScheduler.hpp"
+#include "EclipseLogger.hpp"
+#include "EclipseMetrics.hpp"
+#include "EclipseSolState.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Milliseconds handed to wait, after and every, anything past the wheel's range fires at its end
+    bool ToDelay(lua_Number delay, uint64& ticks)
+    {
+        if (!std::isfinite(delay) || delay < 0)
+            return false;
+
+        ticks = static_cast<uint64>(std::min<lua_Number>(delay, EclipseTimerWheel::MAX_DELAY));
+        return true;
+    }
+
+    // Runs under lua_pcall, the traceback allocates on the state that builds it
+    int BuildTraceback(lua_State* L)
+    {
+        lua_State* thread = lua_tothread(L, 1);
+        const char* message = lua_tostring(L, 2);
+        luaL_traceback(L, thread, message ? message : "unknown error", 0);
+        return 1;
+    }
+}
+
+/**
+ *
+ */
+void EclipseScheduler::Register(sol::state& state)
+{
+    _luaState = state.lua_state();
+
+    // wait has to yield from C, it is pushed as a raw closure over the scheduler
+    lua_pushlightuserdata(_luaState, this);
+    lua_pushcclosure(_luaState, &EclipseScheduler::Wait, 1);
+    lua_setglobal(_luaState, "wait");
+
+    // Thrown rather than raised, sol turns it into a Lua error once these frames are gone
+    state.set_function("after", [this](lua_Number delay, sol::function callback, sol::this_state L) {
+        uint64 ticks;
+        if (!ToDelay(delay, ticks))
+            throw sol::error("bad argument #1 to 'after' (delay must be a finite, non-negative number of milliseconds)");
+
+        return Schedule(std::move(callback), ticks, 0, EclipseSolState::GetCallingScript(L));
+    });
+
+    state.set_function("every", [this](lua_Number interval, sol::function callback, sol::this_state L) {
+        uint64 ticks;
+        if (!ToDelay(interval, ticks))
+            throw sol::error("bad argument #1 to 'every' (interval must be a finite, non-negative number of milliseconds)");
+
+        return Schedule(std::move(callback), ticks, std::max<uint64>(ticks, 1), EclipseSolState::GetCallingScript(L));
+    });
+
+    state.set_function("cancel", [this](TaskId taskId) {
+        return Cancel(taskId);
+    });
+}
+
+/**
+ * Called from the map update tick, diff is in milliseconds
+ */
+void EclipseScheduler::Update(uint32 diff)
+{
+    _expired.clear();
+    _wheel.Advance(diff, _expired);
+
+    if (_expired.empty())
+        return;
+
+    uint32 fired = 0;
+    for (const EclipseTimerWheel::ExpiredTimer& timer : _expired)
+    {
+        // Cancelled by a task that ran earlier in this update
+        uint32 index = timer.payload;
+        if (_tasks[index].timerId != timer.id)
+            continue;
+
+        // Tasks may be added while running, nothing below holds on to the slot
+        Task& task = _tasks[index];
+        std::string owner = task.owner;
+        ++fired;
+
+        if (task.thread.valid())
+        {
+            sol::thread thread = std::move(task.thread);
+            Release(index);
+            Resume(thread.thread_state(), owner);
+        }
+        else if (!task.interval)
+        {
+            sol::function callback = std::move(task.callback);
+            Release(index);
+            RunCallback(callback, owner);
+        }
+        else
+        {
+            task.timerId = _wheel.Schedule(task.interval, index);
+            sol::function callback = task.callback;
+            RunCallback(callback, owner);
+        }
+    }
+
+    EclipseMetrics::GetInstance().Increment(METRIC_TIMERS_FIRED, fired);
+}
+
+/**
+ * Without an interval the callback runs once
+ */
+EclipseScheduler::TaskId EclipseScheduler::Schedule(sol::function callback, uint64 delay, uint64 interval, const std::string& owner)
+{
+    if (!callback.valid())
+        return 0;
+
+    Task task;
+    task.interval = interval;
+    task.callback = std::move(callback);
+    task.owner = owner;
+    return Insert(std::move(task), delay);
+}
+
+/**
+ *
+ */
+bool EclipseScheduler::Cancel(TaskId taskId)
+{
+    uint32 index = static_cast<uint32>(taskId);
+    if (index >= _tasks.size())
+        return false;
+
+    Task& task = _tasks[index];
+    if (task.timerId == EclipseTimerWheel::INVALID_TIMER || task.generation != static_cast<uint32>(taskId >> 32))
+        return false;
+
+    _wheel.Cancel(task.timerId);
+    Release(index);
+    return true;
+}
+
+/**
+ * Waiting coroutines of the owner are dropped as well, they are never resumed
+ */
+void EclipseScheduler::ClearOwner(const std::string& owner)
+{
+    for (uint32 index = 0; index < _tasks.size(); ++index)
+    {
+        Task& task = _tasks[index];
+        if (task.timerId == EclipseTimerWheel::INVALID_TIMER || task.owner != owner)
+            continue;
+
+        _wheel.Cancel(task.timerId);
+        Release(index);
+    }
+}
+
+/**
+ *
+ */
+void EclipseScheduler::ClearAll()
+{
+    _wheel.Clear();
+
+    for (uint32 index = 0; index < _tasks.size(); ++index)
+        if (_tasks[index].timerId != EclipseTimerWheel::INVALID_TIMER)
+            Release(index);
+}
+
+/**
+ * wait(ms), suspends the calling coroutine until the delay has passed
+ */
+int EclipseScheduler::Wait(lua_State* L)
+{
+    EclipseScheduler* scheduler = static_cast<EclipseScheduler*>(lua_touserdata(L, lua_upvalueindex(1)));
+    uint64 delay;
+    if (!ToDelay(luaL_checknumber(L, 1), delay))
+        return luaL_argerror(L, 1, "delay must be a finite, non-negative number of milliseconds");
+
+#ifdef SOL_LUAJIT
+    bool yieldable = !lua_pushthread(L);
+    lua_pop(L, 1);
+#else
+    bool yieldable = lua_isyieldable(L);
+#endif
+
+    if (!yieldable)
+        return luaL_error(L, "wait can only be called from a coroutine");
+
+    Task task;
+    lua_pushthread(L);
+    task.thread = sol::thread(L, -1);
+    lua_pop(L, 1);
+    task.owner = EclipseSolState::GetCallingScript(L);
+
+    scheduler->Insert(std::move(task), delay);
+    return lua_yield(L, 0);
+}
+
+/**
+ *
+ */
+EclipseScheduler::TaskId EclipseScheduler::Insert(Task&& task, uint64 delay)
+{
+    uint32 index;
+    if (!_freeTasks.empty())
+    {
+        index = _freeTasks.back();
+        _freeTasks.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32>(_tasks.size());
+        _tasks.emplace_back();
+    }
+
+    Task& slot = _tasks[index];
+    uint32 generation = slot.generation;
+    slot = std::move(task);
+    slot.generation = generation;
+    slot.timerId = _wheel.Schedule(delay, index);
+
+    return (uint64(generation) << 32) | index;
+}
+
+/**
+ * Generation bump invalidates the task id handed to Lua
+ */
+void EclipseScheduler::Release(uint32 index)
+{
+    Task& task = _tasks[index];
+    task.timerId = EclipseTimerWheel::INVALID_TIMER;
+    task.thread = sol::thread();
+    task.callback = sol::function();
+    task.owner.clear();
+    ++task.generation;
+
+    _freeTasks.push_back(index);
+}
+
+/**
+ * The thread reference keeps the coroutine alive while it runs, a wait inside takes its own
+ */
+void EclipseScheduler::RunCallback(const sol::function& callback, const std::string& owner)
+{
+    lua_State* thread = lua_newthread(_luaState);
+    sol::thread reference(_luaState, -1);
+    lua_pop(_luaState, 1);
+
+    callback.push(thread);
+    Resume(thread, owner);
+}
+
+/**
+ * Every resume gets the default budget of the state, a coroutine that waits starts over at the next one
+ */
+void EclipseScheduler::Resume(lua_State* thread, const std::string& owner)
+{
+    EclipseBudgetScope budgetScope(_budget, owner, {}, thread);
+
+#ifdef SOL_LUAJIT
+    int status = lua_resume(thread, 0);
+#else
+    int results = 0;
+    int status = lua_resume(thread, _luaState, 0, &results);
+#endif
+
+    // Finished or suspended again, values passed to yield or return are dropped
+    if (status == LUA_OK || status == LUA_YIELD)
+    {
+        lua_settop(thread, 0);
+        return;
+    }
+
+    // A failed traceback leaves its own error to log, the message of the timer is lost then
+    if (lua_checkstack(_luaState, 3))
+    {
+        lua_pushcfunction(_luaState, &BuildTraceback);
+        lua_pushthread(thread);
+        lua_xmove(thread, _luaState, 1);
+        lua_xmove(thread, _luaState, 1);
+        lua_pcall(_luaState, 2, 1, 0);
+
+        const char* traceback = lua_tostring(_luaState, -1);
+        ECLIPSE_LOG_ERROR("[Eclipse]: Error in timer registered by `{}`: {}", owner, traceback ? traceback : "unknown error");
+        lua_pop(_luaState, 1);
+    }
+    else
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Error in timer registered by `{}`: stack overflow", owner);
+    }
+
+    EclipseMetrics::GetInstance().Increment(METRIC_SCRIPT_ERRORS);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_SCHEDULER_HPP
+#define ECLIPSE_SCHEDULER_HPP
+
+#include "EclipseIncludes.hpp"
+#include "EclipseExecutionBudget.hpp"
+#include "EclipseTimerWheel.hpp"
+
+#include <string>
+#include <vector>
+
+// Coroutine scheduler of one Lua state, advanced by the map update tick. wait(ms) suspends the running
+// coroutine, after(ms, fn) and every(ms, fn) run their callback in a fresh coroutine so it can wait too.
+class EclipseScheduler
+{
+    public:
+        typedef uint64 TaskId;
+
+        EclipseScheduler() = default;
+
+        void Register(sol::state& state);
+        void SetBudget(EclipseExecutionBudget* budget) { _budget = budget; }
+        void Update(uint32 diff);
+
+        TaskId Schedule(sol::function callback, uint64 delay, uint64 interval, const std::string& owner = "");
+        bool Cancel(TaskId taskId);
+        void ClearOwner(const std::string& owner);
+        void ClearAll();
+
+        std::size_t GetPendingCount() const { return _wheel.GetCount(); }
+
+    private:
+        EclipseScheduler(const EclipseScheduler&) = delete;
+        EclipseScheduler& operator=(const EclipseScheduler&) = delete;
+
+        // A waiting coroutine holds its thread, a callback task its function
+        struct Task
+        {
+            EclipseTimerWheel::TimerId timerId = EclipseTimerWheel::INVALID_TIMER;
+            uint32 generation = 1;
+            uint64 interval = 0;
+            sol::thread thread;
+            sol::function callback;
+            std::string owner;
+        };
+
+        static int Wait(lua_State* L);
+
+        TaskId Insert(Task&& task, uint64 delay);
+        void Release(uint32 index);
+        void RunCallback(const sol::function& callback, const std::string& owner);
+        void Resume(lua_State* thread, const std::string& owner);
+
+        lua_State* _luaState = nullptr;
+        EclipseExecutionBudget* _budget = nullptr;
+        EclipseTimerWheel _wheel;
+        std::vector<Task> _tasks;
+        std::vector<uint32> _freeTasks;
+        std::vector<EclipseTimerWheel::ExpiredTimer> _expired;
+};
+
+#endif // ECLIPSE_SCHEDULER_HPP
@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseScriptBundle.hpp"
+#include "EclipseHash.hpp"
+
+#include <boost/filesystem.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#ifndef ECLIPSE_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr char BUNDLE_MAGIC[8] = { 'E', 'C', 'L', 'B', 'N', 'D', 'L', '\0' };
+    constexpr uint32 BUNDLE_FLAG_STRIPPED = 0x01;
+    constexpr uint32 NO_DEBUG_INFO = 0xFFFFFFFF;
+
+    // Layout: header, one record per script, string section, bytecode
+    struct BundleHeader
+    {
+        char magic[8];
+        uint32 version;
+        uint32 flags;
+        uint32 scriptCount;
+        uint32 vmVersion;       // offsets into the string section
+        uint32 manifest;
+        uint32 reserved;
+        uint64 stringsOffset;
+        uint64 stringsSize;
+        uint64 stringsHash;     // XXH64 of the string section
+    };
+
+    struct BundleRecord
+    {
+        uint64 bytecodeOffset;  // from the start of the file
+        uint64 bytecodeSize;
+        uint64 bytecodeHash;    // XXH64 of the bytecode, checked on load
+        uint64 contentHash;
+        uint32 path;            // offsets into the string section
+        uint32 dependencies;
+        uint32 functions;       // function names followed by line tables, NO_DEBUG_INFO without a side table
+        uint32 group;
+    };
+
+    static_assert(sizeof(BundleHeader) == 56 && sizeof(BundleRecord) == 48);
+
+    // Flushes a written file or the directory entries of a rename to disk, a no-op on Windows
+    bool SyncPath(const std::string& path, std::string& error)
+    {
+#ifndef ECLIPSE_WINDOWS
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fsync(fd) != 0)
+        {
+            error = "unable to sync `" + path + "`: " + std::strerror(errno);
+            if (fd >= 0)
+                close(fd);
+
+            return false;
+        }
+
+        close(fd);
+#endif
+        return true;
+    }
+
+    template<typename T>
+    void AppendValue(std::string& buffer, const T& value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void AppendString(std::string& buffer, std::string_view value)
+    {
+        AppendValue(buffer, static_cast<uint32>(value.size()));
+        buffer.append(value);
+    }
+
+    // Bounds checked cursor over the string section, strings are stored as size followed by the bytes
+    class BundleReader
+    {
+        public:
+            BundleReader(std::string_view data, uint64 offset) : _data(data), _offset(offset) {}
+
+            template<typename T>
+            bool Read(T& value)
+            {
+                if (_offset > _data.size() || _data.size() - _offset < sizeof(T))
+                    return false;
+
+                std::memcpy(&value, _data.data() + _offset, sizeof(T));
+                _offset += sizeof(T);
+                return true;
+            }
+
+            bool ReadString(std::string_view& value)
+            {
+                uint32 size;
+                if (!Read(size) || _data.size() - _offset < size)
+                    return false;
+
+                value = _data.substr(_offset, size);
+                _offset += size;
+                return true;
+            }
+
+        private:
+            std::string_view _data;
+            uint64 _offset;
+    };
+}
+
+EclipseScriptBundle::~EclipseScriptBundle()
+{
+#ifndef ECLIPSE_WINDOWS
+    if (_mapping)
+        munmap(_mapping, _data.size());
+#endif
+}
+
+/**
+ *
+ */
+std::shared_ptr<const EclipseScriptBundle> EclipseScriptBundle::Open(const std::string& filePath, std::string& error)
+{
+    std::shared_ptr<EclipseScriptBundle> bundle(new EclipseScriptBundle());
+    if (!bundle->Map(filePath, error) || !bundle->Parse(error))
+        return nullptr;
+
+    return bundle;
+}
+
+/**
+ *
+ */
+bool EclipseScriptBundle::Write(const std::string& filePath, const std::vector<BundleScriptSource>& scripts, std::string_view manifest, bool stripped, std::string& error)
+{
+    std::string strings;
+    auto addString = [&strings](std::string_view value) {
+        uint32 offset = static_cast<uint32>(strings.size());
+        AppendString(strings, value);
+        return offset;
+    };
+
+    BundleHeader header{};
+    std::memcpy(header.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    header.version = VERSION;
+    header.flags = stripped ? BUNDLE_FLAG_STRIPPED : 0;
+    header.scriptCount = static_cast<uint32>(scripts.size());
+    header.vmVersion = addString(EclipseCache::GetLuaVMVersion());
+    header.manifest = addString(manifest);
+
+    std::vector<BundleRecord> records;
+    records.reserve(scripts.size());
+
+    uint64 bytecodeSize = 0;
+    for (const BundleScriptSource& script : scripts)
+    {
+        BundleRecord& record = records.emplace_back();
+        record.bytecodeOffset = bytecodeSize; // rebased once the string section is complete
+        record.bytecodeSize = script.bytecode.GetSize();
+        record.bytecodeHash = EclipseHash::Compute(script.bytecode.GetView());
+        record.contentHash = script.contentHash;
+        record.group = script.group;
+        record.path = addString(script.path);
+
+        record.dependencies = static_cast<uint32>(strings.size());
+        AppendValue(strings, static_cast<uint32>(script.dependencies.size()));
+        for (const std::string& dependency : script.dependencies)
+            AppendString(strings, dependency);
+
+        record.functions = NO_DEBUG_INFO;
+        if (script.debugInfo)
+        {
+            record.functions = static_cast<uint32>(strings.size());
+            AppendValue(strings, static_cast<uint32>(script.debugInfo->functions.size()));
+            for (const ScriptFunctionInfo& function : script.debugInfo->functions)
+            {
+                AppendValue(strings, function.line);
+                AppendString(strings, function.name);
+            }
+
+            AppendValue(strings, static_cast<uint32>(script.debugInfo->lines.size()));
+            for (const ScriptLineInfo& lines : script.debugInfo->lines)
+            {
+                AppendValue(strings, lines.lineDefined);
+                AppendValue(strings, lines.lastLineDefined);
+                AppendValue(strings, lines.instructionCount);
+                AppendString(strings, lines.lineDeltas);
+            }
+        }
+
+        bytecodeSize += record.bytecodeSize;
+    }
+
+    if (strings.size() >= NO_DEBUG_INFO)
+    {
+        error = "string section exceeds 4 GB";
+        return false;
+    }
+
+    header.stringsOffset = sizeof(BundleHeader) + records.size() * sizeof(BundleRecord);
+    header.stringsSize = strings.size();
+    header.stringsHash = EclipseHash::Compute(strings);
+    for (BundleRecord& record : records)
+        record.bytecodeOffset += header.stringsOffset + header.stringsSize;
+
+    // Replacing the file keeps the old inode alive for servers that still map it,
+    // writing into it in place would pull pages out from under them. The temporary name is
+    // unique so concurrent writers never share one, and both the file and the rename are synced
+    // so a crash leaves either the old bundle or the complete new one.
+    boost::system::error_code errorCode;
+    boost::filesystem::path targetPath(filePath);
+    std::string tempPath = boost::filesystem::unique_path(targetPath.filename().string() + ".%%%%-%%%%-%%%%.tmp").string();
+    if (targetPath.has_parent_path())
+        tempPath = (targetPath.parent_path() / tempPath).string();
+
+    {
+        std::ofstream bundle(tempPath, std::ios::binary | std::ios::trunc);
+        if (!bundle)
+        {
+            error = "unable to create `" + tempPath + "`";
+            return false;
+        }
+
+        bundle.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        bundle.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(BundleRecord));
+        bundle.write(strings.data(), strings.size());
+        for (const BundleScriptSource& script : scripts)
+            bundle.write(script.bytecode.GetData(), script.bytecode.GetSize());
+
+        if (!bundle.flush())
+        {
+            error = "unable to write `" + tempPath + "`";
+            bundle.close();
+            boost::filesystem::remove(tempPath, errorCode);
+            return false;
+        }
+    }
+
+    if (!SyncPath(tempPath, error))
+    {
+        boost::filesystem::remove(tempPath, errorCode);
+        return false;
+    }
+
+    boost::filesystem::rename(tempPath, filePath, errorCode);
+    if (errorCode)
+    {
+        error = errorCode.message();
+        boost::filesystem::remove(tempPath, errorCode);
+        return false;
+    }
+
+    return SyncPath(targetPath.has_parent_path() ? targetPath.parent_path().string() : ".", error);
+}
+
+/**
+ * Falls back to reading the whole file where it cannot be mapped
+ */
+bool EclipseScriptBundle::Map(const std::string& filePath, std::string& error)
+{
+#ifndef ECLIPSE_WINDOWS
+    int fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        error = std::strerror(errno);
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+    {
+        std::size_t size = static_cast<std::size_t>(fileStat.st_size);
+        void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            _mapping = mapping;
+            _data = std::string_view(static_cast<const char*>(mapping), size);
+        }
+    }
+
+    // The mapping outlives the descriptor
+    close(fd);
+    if (_mapping)
+        return true;
+#endif
+
+    if (!EclipseCache::ReadScriptFile(filePath, _buffer))
+    {
+        error = "unable to read file";
+        return false;
+    }
+
+    _data = _buffer;
+    return true;
+}
+
+/**
+ * Everything is bounds checked and hashed, a truncated, damaged or foreign file is rejected as a whole
+ */
+bool EclipseScriptBundle::Parse(std::string& error)
+{
+    BundleHeader header;
+    if (_data.size() < sizeof(header))
+    {
+        error = "file is too small";
+        return false;
+    }
+
+    std::memcpy(&header, _data.data(), sizeof(header));
+    if (std::memcmp(header.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0)
+    {
+        error = "not a script bundle";
+        return false;
+    }
+
+    if (header.version != VERSION)
+    {
+        error = "unsupported bundle version " + std::to_string(header.version);
+        return false;
+    }
+
+    uint64 recordsEnd = sizeof(BundleHeader) + static_cast<uint64>(header.scriptCount) * sizeof(BundleRecord);
+    if (header.stringsOffset < recordsEnd || header.stringsOffset > _data.size() || _data.size() - header.stringsOffset < header.stringsSize)
+    {
+        error = "file is truncated";
+        return false;
+    }
+
+    std::string_view strings = _data.substr(header.stringsOffset, header.stringsSize);
+    std::string_view vmVersion;
+    if (EclipseHash::Compute(strings) != header.stringsHash || !BundleReader(strings, header.vmVersion).ReadString(vmVersion) || !BundleReader(strings, header.manifest).ReadString(_manifest))
+    {
+        error = "corrupt string section";
+        return false;
+    }
+
+    if (vmVersion != EclipseCache::GetLuaVMVersion())
+    {
+        error = "built for " + std::string(vmVersion) + ", running " + EclipseCache::GetLuaVMVersion();
+        return false;
+    }
+
+    _stripped = (header.flags & BUNDLE_FLAG_STRIPPED) != 0;
+    _scripts.reserve(header.scriptCount);
+
+    for (uint32 i = 0; i < header.scriptCount; ++i)
+    {
+        BundleRecord record;
+        std::memcpy(&record, _data.data() + sizeof(BundleHeader) + i * sizeof(BundleRecord), sizeof(record));
+
+        BundleScript& script = _scripts.emplace_back();
+        script.contentHash = record.contentHash;
+        script.group = record.group;
+
+        bool valid = record.bytecodeOffset <= _data.size() && _data.size() - record.bytecodeOffset >= record.bytecodeSize
+            && BundleReader(strings, record.path).ReadString(script.path);
+
+        if (valid)
+            script.bytecode = _data.substr(record.bytecodeOffset, record.bytecodeSize);
+
+        uint32 count = 0;
+        BundleReader dependencies(strings, record.dependencies);
+        valid = valid && dependencies.Read(count);
+        for (uint32 j = 0; valid && j < count; ++j)
+        {
+            std::string_view dependency;
+            valid = dependencies.ReadString(dependency);
+            script.dependencies.emplace_back(dependency);
+        }
+
+        if (valid && record.functions != NO_DEBUG_INFO)
+        {
+            auto debugInfo = std::make_shared<ScriptDebugInfo>();
+            BundleReader functions(strings, record.functions);
+            valid = functions.Read(count);
+            for (uint32 j = 0; valid && j < count; ++j)
+            {
+                ScriptFunctionInfo& function = debugInfo->functions.emplace_back();
+                std::string_view name;
+                valid = functions.Read(function.line) && functions.ReadString(name);
+                function.name = name;
+            }
+
+            valid = valid && functions.Read(count);
+            for (uint32 j = 0; valid && j < count; ++j)
+            {
+                ScriptLineInfo& lines = debugInfo->lines.emplace_back();
+                std::string_view lineDeltas;
+                valid = functions.Read(lines.lineDefined) && functions.Read(lines.lastLineDefined) && functions.Read(lines.instructionCount)
+                    && functions.ReadString(lineDeltas);
+                lines.lineDeltas = lineDeltas;
+            }
+
+            script.debugInfo = std::move(debugInfo);
+        }
+
+        if (!valid)
+        {
+            error = "corrupt record " + std::to_string(i);
+            return false;
+        }
+
+        // A flipped byte in bytecode would otherwise reach lua_load, which trusts it blindly
+        if (EclipseHash::Compute(script.bytecode) != record.bytecodeHash)
+        {
+            error = "corrupt bytecode for `" + std::string(script.path) + "`";
+            return false;
+        }
+    }
+
+    return true;
+}
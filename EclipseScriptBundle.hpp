@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_SCRIPT_BUNDLE_HPP
+#define ECLIPSE_SCRIPT_BUNDLE_HPP
+
+#include "EclipseIncludes.hpp"
+#include "EclipseCache.hpp"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A script as it goes into a bundle, paths are relative to the script folder
+struct BundleScriptSource
+{
+    std::string path;
+    ScriptBytecode bytecode;
+    uint64 contentHash = 0;
+    uint32 group = 0;
+    std::vector<std::string> dependencies;
+    std::shared_ptr<const ScriptDebugInfo> debugInfo;
+};
+
+// A script read back from a bundle, path and bytecode point into the mapping
+struct BundleScript
+{
+    std::string_view path;
+    std::string_view bytecode;
+    uint64 contentHash = 0;
+    uint32 group = 0;
+    std::vector<std::string> dependencies;
+    std::shared_ptr<const ScriptDebugInfo> debugInfo;
+};
+
+// Single file holding every compiled script, their requires, the execution plan and the manifest.
+// Scripts are stored in plan order, extensions first, each tagged with its group in the plan.
+// The file is mapped read only and bytecode handed to states is a view on the mapping, the
+// bundle stays mapped until the last ScriptBytecode referencing it is gone. Bundles are tied
+// to the Lua VM and platform that built them, like the bytecode inside.
+class EclipseScriptBundle
+{
+    public:
+        static constexpr uint32 VERSION = 3;
+
+        ~EclipseScriptBundle();
+
+        static std::shared_ptr<const EclipseScriptBundle> Open(const std::string& filePath, std::string& error);
+
+        // Written next to the target and renamed over it, a running server never sees half a bundle
+        static bool Write(const std::string& filePath, const std::vector<BundleScriptSource>& scripts, std::string_view manifest, bool stripped, std::string& error);
+
+        const std::vector<BundleScript>& GetScripts() const { return _scripts; }
+        std::string_view GetManifest() const { return _manifest; }
+        bool IsStripped() const { return _stripped; }
+        bool IsMapped() const { return _mapping != nullptr; }
+        std::size_t GetSize() const { return _data.size(); }
+
+    private:
+        EclipseScriptBundle() = default;
+        EclipseScriptBundle(const EclipseScriptBundle&) = delete;
+        EclipseScriptBundle& operator=(const EclipseScriptBundle&) = delete;
+
+        bool Map(const std::string& filePath, std::string& error);
+        bool Parse(std::string& error);
+
+        void* _mapping = nullptr;
+        std::string _buffer; // read fallback when the file cannot be mapped
+        std::string_view _data;
+
+        std::string_view _manifest;
+        std::vector<BundleScript> _scripts;
+        bool _stripped = false;
+};
+
+#endif // ECLIPSE_SCRIPT_BUNDLE_HPP
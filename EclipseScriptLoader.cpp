@@ -7,9 +7,19 @@
 #include "EclipseCompiler.hpp"
 #include "EclipseCache.hpp"
 #include "EclipseConfig.hpp"
+#include "EclipseHash.hpp"
 #include "EclipseLogger.hpp"
+#include "EclipseMetrics.hpp"
+#include "EclipseScriptBundle.hpp"
 #include "EclipseScriptLoader.hpp"
 
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
 std::string EclipseScriptLoader::lua_folderpath;
 std::string EclipseScriptLoader::lua_requirepath;
 std::string EclipseScriptLoader::lua_requirecpath;
@@ -17,6 +27,114 @@ std::string EclipseScriptLoader::lua_requirecpath;
 EclipseScriptLoader::ScriptMap EclipseScriptLoader::lua_extensionsMap;
 EclipseScriptLoader::ScriptMap EclipseScriptLoader::lua_scriptsMap;
 
+std::unordered_map<std::string, ScriptScope> EclipseScriptLoader::lua_scriptScopes;
+std::unordered_map<std::string, std::vector<std::string>> EclipseScriptLoader::lua_scriptDependencies;
+
+ScriptExecutionPlan EclipseScriptLoader::lua_extensionsPlan;
+ScriptExecutionPlan EclipseScriptLoader::lua_scriptsPlan;
+
+std::mutex EclipseScriptLoader::lua_buildLock;
+std::atomic<std::shared_ptr<const ScriptGeneration>> EclipseScriptLoader::lua_generation{ std::make_shared<const ScriptGeneration>() };
+
+namespace
+{
+    constexpr char const* SCRIPT_MANIFEST_FILE = "eclipse.manifest";
+
+    uint8 GetMapTypeMask(const std::string& mapType)
+    {
+        static const std::unordered_map<std::string, uint8> mapTypes{
+            { "world",          SCRIPT_MAP_TYPE_WORLD },
+            { "dungeon",        SCRIPT_MAP_TYPE_DUNGEON },
+            { "raid",           SCRIPT_MAP_TYPE_RAID },
+            { "battleground",   SCRIPT_MAP_TYPE_BATTLEGROUND },
+            { "arena",          SCRIPT_MAP_TYPE_ARENA }
+        };
+
+        auto it = mapTypes.find(mapType);
+        return it != mapTypes.end() ? it->second : 0;
+    }
+
+    std::vector<std::string> SplitList(const std::string& list)
+    {
+        std::vector<std::string> values;
+        std::istringstream stream(list);
+        for (std::string value; std::getline(stream, value, ',');)
+            if (!value.empty())
+                values.push_back(std::move(value));
+
+        return values;
+    }
+}
+
+/**
+ *
+ */
+bool ScriptScope::AppliesTo(const Map* map) const
+{
+    // The global state only carries scripts that are not tied to any map
+    if (!map)
+        return IsGlobal();
+
+    if (!mapIds.empty() && !mapIds.count(map->GetId()))
+        return false;
+
+    uint8 mapType = SCRIPT_MAP_TYPE_WORLD;
+    if (map->IsBattleArena())
+        mapType = SCRIPT_MAP_TYPE_ARENA;
+    else if (map->IsBattleground())
+        mapType = SCRIPT_MAP_TYPE_BATTLEGROUND;
+    else if (map->IsRaid())
+        mapType = SCRIPT_MAP_TYPE_RAID;
+    else if (map->IsDungeon())
+        mapType = SCRIPT_MAP_TYPE_DUNGEON;
+
+    return (mapTypes & mapType) != 0;
+}
+
+/**
+ *
+ */
+const LuaScript* ScriptGeneration::FindModule(const std::string& moduleName) const
+{
+    auto it = extensions.find(moduleName);
+    if (it != extensions.end())
+        return &it->second;
+
+    it = scripts.find(moduleName);
+    return it != scripts.end() ? &it->second : nullptr;
+}
+
+/**
+ * Served from the cache as it was when the generation was published, later compiles do not leak in
+ */
+ScriptBytecode ScriptGeneration::GetBytecode(const std::string& filePath) const
+{
+    if (bytecode)
+    {
+        auto it = bytecode->find(filePath);
+        if (it != bytecode->end() && !it->second.bytecode.IsEmpty())
+        {
+            EclipseMetrics::GetInstance().Increment(METRIC_CACHE_HITS);
+            return it->second.bytecode;
+        }
+    }
+
+    EclipseMetrics::GetInstance().Increment(METRIC_CACHE_MISSES);
+    return {};
+}
+
+/**
+ * Side table of the bytecode this generation runs, not of whatever the cache holds now
+ */
+std::shared_ptr<const ScriptDebugInfo> ScriptGeneration::GetDebugInfo(const std::string& filePath) const
+{
+    if (!bytecode)
+        return nullptr;
+
+    auto it = bytecode->find(filePath);
+    return it != bytecode->end() ? it->second.debug_info : nullptr;
+}
+
 /**
  *
  */
@@ -34,6 +152,9 @@ bool EclipseScriptLoader::IsValidScriptExtension(std::string& extension)
  */
 void EclipseScriptLoader::ClearLuaScriptPaths()
 {
+    // Plans point into the maps
+    lua_extensionsPlan.Clear();
+    lua_scriptsPlan.Clear();
     lua_extensionsMap.clear();
     lua_scriptsMap.clear();
 
@@ -52,6 +173,141 @@ void EclipseScriptLoader::ClearLuaScriptPaths()
 #endif
 }
 
+/**
+ * Hands the generation built so far to the states. Swapping the maps keeps their nodes in
+ * place, so the plans built over them stay valid in the published generation.
+ */
+void EclipseScriptLoader::PublishGeneration(bool fullReload, std::unordered_set<std::string> changedPaths)
+{
+    std::shared_ptr<const ScriptGeneration> current = GetGeneration();
+
+    auto generation = std::make_shared<ScriptGeneration>();
+    generation->id = current->id + 1;
+    generation->baseId = current->id;
+    generation->fullReload = fullReload;
+    generation->changedPaths = std::move(changedPaths);
+
+    generation->folderPath = lua_folderpath;
+    generation->requirePath = lua_requirepath;
+    generation->requireCPath = lua_requirecpath;
+
+    generation->extensions.swap(lua_extensionsMap);
+    generation->scripts.swap(lua_scriptsMap);
+    generation->extensionsPlan.order.swap(lua_extensionsPlan.order);
+    generation->extensionsPlan.groupOffsets.swap(lua_extensionsPlan.groupOffsets);
+    generation->scriptsPlan.order.swap(lua_scriptsPlan.order);
+    generation->scriptsPlan.groupOffsets.swap(lua_scriptsPlan.groupOffsets);
+    generation->bytecode = EclipseCache::GetInstance().GetSnapshot();
+
+    lua_generation.store(std::move(generation), std::memory_order_release);
+}
+
+/**
+ * Each line names a script (without extension) followed by its scope, for example:
+ *   instance_karazhan maps=532
+ *   bg_rewards types=battleground,arena
+ *   utils lazy
+ *   quest_rewards depends=utils,loot_tables
+ */
+void EclipseScriptLoader::LoadScriptManifest()
+{
+    std::ifstream manifest(lua_folderpath + "/" + SCRIPT_MANIFEST_FILE);
+    ParseScriptManifest(manifest);
+}
+
+/**
+ * Bundles carry the manifest they were built with
+ */
+void EclipseScriptLoader::ParseScriptManifest(std::istream& manifest)
+{
+    lua_scriptScopes.clear();
+    lua_scriptDependencies.clear();
+
+    if (!manifest)
+        return;
+
+    uint32 lineNumber = 0;
+    for (std::string line; std::getline(manifest, line);)
+    {
+        ++lineNumber;
+
+        std::istringstream tokens(line);
+        std::string scriptName;
+        if (!(tokens >> scriptName) || scriptName[0] == '#')
+            continue;
+
+        ScriptScope scope;
+        for (std::string token; tokens >> token;)
+        {
+            std::size_t separator = token.find('=');
+            std::string key = token.substr(0, separator);
+            std::string value = separator != std::string::npos ? token.substr(separator + 1) : "";
+
+            // Only lifts the map filters, lazy is kept whichever side of it it is on
+            if (key == "global")
+            {
+                scope.mapTypes = SCRIPT_MAP_TYPE_ALL;
+                scope.mapIds.clear();
+            }
+            else if (key == "lazy")
+                scope.lazy = true;
+            else if (key == "maps")
+            {
+                for (const std::string& mapId : SplitList(value))
+                {
+                    uint32 id = 0;
+                    auto [end, error] = std::from_chars(mapId.data(), mapId.data() + mapId.size(), id);
+                    if (error != std::errc() || end != mapId.data() + mapId.size())
+                    {
+                        ECLIPSE_LOG_ERROR("[Eclipse]: Invalid map id `{}` for script `{}` in {} line {}", mapId, scriptName, SCRIPT_MANIFEST_FILE, lineNumber);
+                        continue;
+                    }
+
+                    scope.mapIds.insert(id);
+                }
+            }
+            else if (key == "types")
+            {
+                uint8 mapTypes = 0;
+                for (const std::string& mapType : SplitList(value))
+                {
+                    uint8 mask = GetMapTypeMask(mapType);
+                    if (!mask)
+                        ECLIPSE_LOG_ERROR("[Eclipse]: Unknown map type `{}` for script `{}` in {} line {}", mapType, scriptName, SCRIPT_MANIFEST_FILE, lineNumber);
+
+                    mapTypes |= mask;
+                }
+
+                // An empty mask would silently keep the script from running anywhere
+                if (mapTypes)
+                    scope.mapTypes = mapTypes;
+                else
+                    ECLIPSE_LOG_ERROR("[Eclipse]: No valid map type in `{}` for script `{}` in {} line {}, ignoring it", token, scriptName, SCRIPT_MANIFEST_FILE, lineNumber);
+            }
+            else if (key == "depends")
+            {
+                std::vector<std::string>& dependencies = lua_scriptDependencies[scriptName];
+                for (std::string& dependency : SplitList(value))
+                    dependencies.push_back(std::move(dependency));
+            }
+            else
+                ECLIPSE_LOG_ERROR("[Eclipse]: Unknown scope `{}` for script `{}` in {} line {}", token, scriptName, SCRIPT_MANIFEST_FILE, lineNumber);
+        }
+
+        lua_scriptScopes[scriptName] = std::move(scope);
+    }
+
+    ECLIPSE_LOG_DEBUG("[Eclipse]: Loaded {} script scopes from {}", lua_scriptScopes.size(), SCRIPT_MANIFEST_FILE);
+}
+
+/**
+ *
+ */
+bool EclipseScriptLoader::IsScriptManifest(const std::string& fileName)
+{
+    return fileName == SCRIPT_MANIFEST_FILE;
+}
+
 /**
  *
  */
@@ -64,59 +320,557 @@ bool EclipseScriptLoader::LoadScriptPaths()
 
     eclipseCache.SetCacheState(SCRIPT_CACHE_LOADING);
 
+    std::lock_guard<std::mutex> buildGuard(lua_buildLock);
     auto startTime = std::chrono::high_resolution_clock::now();
 
     ClearLuaScriptPaths();
 
-    sol::state tempState = sol::state();
-    tempState.open_libraries(
-        sol::lib::base,
-        sol::lib::package
-    );
+    const auto& config = EclipseConfig::GetInstance();
+    std::string bundlePath(config.GetScriptBundle());
+    bool fromBundle = !bundlePath.empty() && LoadScriptBundle(bundlePath);
+
+    if (!fromBundle)
+    {
+        LoadScriptManifest();
 
-    GetScripts(tempState, lua_folderpath);
+        bool persistentCache = config.IsByteCodeCacheEnabled();
+        std::string cachePath(config.GetByteCodeCachePath());
 
-    if(!lua_requirepath.empty())
-        lua_requirepath.erase(lua_requirepath.end() - 1);
+        // Asking a VM that cannot strip would label full bytecode as stripped in the cache and bundles
+        bool stripBytecode = config.IsStripBytecodeEnabled();
+        if (stripBytecode && !EclipseCompiler::CanStripByteCode())
+        {
+            ECLIPSE_LOG_WARN("[Eclipse]: Stripped bytecode is not supported by this Lua VM, scripts keep their debug info");
+            stripBytecode = false;
+        }
 
-    if(!lua_requirecpath.empty())
-        lua_requirecpath.erase(lua_requirecpath.end() - 1);
+        eclipseCache.SetStripBytecode(stripBytecode);
+        if (persistentCache && eclipseCache.IsEmpty())
+            eclipseCache.LoadFromDisk(cachePath);
+
+        std::vector<LuaScript> scripts;
+        GetScripts(lua_folderpath, scripts);
+        CompileScripts(scripts);
+        BuildExecutionPlans();
+
+        if(!lua_requirepath.empty())
+            lua_requirepath.erase(lua_requirepath.end() - 1);
+
+        if(!lua_requirecpath.empty())
+            lua_requirecpath.erase(lua_requirecpath.end() - 1);
+
+        if (persistentCache)
+            eclipseCache.SaveToDisk(cachePath);
+    }
+
+    std::size_t scriptCount = lua_scriptsMap.size();
+    PublishGeneration(true);
 
     auto endTime = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
 
-    ECLIPSE_LOG_INFO("[Eclipse]: Loaded {} scripts in {} µs", lua_scriptsMap.size(), static_cast<uint32>(duration));
+    ECLIPSE_LOG_INFO("[Eclipse]: Loaded {} scripts in {} µs", scriptCount, static_cast<uint32>(duration));
+
+    // A bundle only changes by being replaced, picked up by the next full reload
+    if (fromBundle)
+        EclipseScriptWatcher::GetInstance().Stop();
+    else if (config.IsAutoReloadEnabled())
+        EclipseScriptWatcher::GetInstance().Start(lua_folderpath, config.GetAutoReloadInterval() * IN_MILLISECONDS);
 
     eclipseCache.SetCacheState(SCRIPT_CACHE_READY);
     return true;
 }
 
 /**
- *
+ * Falls back to the script folder when the bundle cannot be used
  */
-bool EclipseScriptLoader::CompileScript(sol::state& tempstate, LuaScript& script)
+bool EclipseScriptLoader::LoadScriptBundle(const std::string& bundlePath)
 {
-    if(script.fileExt == ".lua" || script.fileExt == ".ext")
+    std::string error;
+    std::shared_ptr<const EclipseScriptBundle> bundle = EclipseScriptBundle::Open(bundlePath, error);
+    if (!bundle)
     {
-        auto& cache = EclipseCache::GetInstance();
-        std::optional<sol::bytecode> bytecode;
+        ECLIPSE_LOG_ERROR("[Eclipse]: Unable to load script bundle `{}`: {}, loading scripts from `{}`", bundlePath, error, lua_folderpath);
+        return false;
+    }
 
-        if (cache.IsScriptModified(script.filePath))
+    std::istringstream manifest{ std::string(bundle->GetManifest()) };
+    ParseScriptManifest(manifest);
+
+    // Entries alias the mapping, the bundle lives as long as one of them is referenced
+    EclipseCache& eclipseCache = EclipseCache::GetInstance();
+    eclipseCache.SetStripBytecode(bundle->IsStripped());
+    eclipseCache.Update([&](EclipseCache::CacheMap& cache)
+    {
+        cache.clear();
+        for (const BundleScript& bundleScript : bundle->GetScripts())
         {
-            bytecode = EclipseCompiler::CompileLuaToByteCode(tempstate, script.filePath);
-            if (bytecode.has_value())
-                cache.StoreByteCode(script.filePath, bytecode.value());
-            else
-                return false;
+            ScriptFileInfo fileInfo;
+            fileInfo.content_hash = bundleScript.contentHash;
+
+            CacheEntry& entry = cache[lua_folderpath + "/" + std::string(bundleScript.path)];
+            entry = CacheEntry(ScriptBytecode(bundle, bundleScript.bytecode), fileInfo, bundleScript.dependencies);
+            entry.debug_info = bundleScript.debugInfo;
         }
+    });
+
+    std::vector<LuaScript> scripts;
+    scripts.reserve(bundle->GetScripts().size());
+    for (const BundleScript& bundleScript : bundle->GetScripts())
+    {
+        std::string filePath = lua_folderpath + "/" + std::string(bundleScript.path);
+        ProcessScript(filePath.substr(filePath.find_last_of('/') + 1), filePath, scripts);
+    }
+
+    for (LuaScript& script : scripts)
+        AddScript(std::move(script));
+
+    // Scripts are stored in plan order, the plans are rebuilt from the group tags without sorting
+    uint32 extensionGroup = 0;
+    uint32 scriptGroup = 0;
+    for (const BundleScript& bundleScript : bundle->GetScripts())
+    {
+        std::string filePath = lua_folderpath + "/" + std::string(bundleScript.path);
+        std::string fileName = filePath.substr(filePath.find_last_of('/') + 1);
+        std::size_t extDot = fileName.find_last_of('.');
+        bool isExtension = extDot != std::string::npos && fileName.compare(extDot, std::string::npos, ".ext") == 0;
+
+        const ScriptMap& scriptMap = isExtension ? lua_extensionsMap : lua_scriptsMap;
+        auto it = scriptMap.find(fileName.substr(0, extDot));
+        if (it == scriptMap.end() || it->second.filePath != filePath)
+            continue;
+
+        ScriptExecutionPlan& plan = isExtension ? lua_extensionsPlan : lua_scriptsPlan;
+        uint32& group = isExtension ? extensionGroup : scriptGroup;
+        if (plan.order.empty() || bundleScript.group != group)
+        {
+            plan.groupOffsets.push_back(plan.order.size());
+            group = bundleScript.group;
+        }
+
+        plan.order.push_back(&it->second);
+    }
+
+    lua_extensionsPlan.groupOffsets.push_back(lua_extensionsPlan.order.size());
+    lua_scriptsPlan.groupOffsets.push_back(lua_scriptsPlan.order.size());
+
+    ECLIPSE_LOG_INFO("[Eclipse]: Loaded script bundle `{}` ({} bytes, {})", bundlePath, bundle->GetSize(), bundle->IsMapped() ? "mapped" : "read");
+    return true;
+}
+
+/**
+ * Packs the published generation, scripts without bytecode are left out
+ */
+bool EclipseScriptLoader::WriteScriptBundle(const std::string& bundlePath)
+{
+    std::shared_ptr<const ScriptGeneration> generation = GetGeneration();
+    const EclipseCache::CacheSnapshot& snapshot = generation->bytecode;
+    if (!snapshot)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Unable to write script bundle `{}`: no scripts are loaded", bundlePath);
+        return false;
+    }
+
+    std::string folderPrefix = generation->folderPath + "/";
+
+    std::vector<BundleScriptSource> sources;
+    auto addPlan = [&](const ScriptExecutionPlan& plan)
+    {
+        for (std::size_t group = 0; group < plan.GetGroupCount(); ++group)
+        {
+            for (std::size_t i = plan.groupOffsets[group]; i < plan.groupOffsets[group + 1]; ++i)
+            {
+                const LuaScript* script = plan.order[i];
+                auto entryIt = snapshot->find(script->filePath);
+                if (entryIt == snapshot->end() || entryIt->second.bytecode.IsEmpty() || script->filePath.compare(0, folderPrefix.size(), folderPrefix) != 0)
+                {
+                    ECLIPSE_LOG_WARN("[Eclipse]: Script `{}` has no bytecode, it is not added to the bundle", script->filePath);
+                    continue;
+                }
+
+                BundleScriptSource& source = sources.emplace_back();
+                source.path = script->filePath.substr(folderPrefix.size());
+                source.bytecode = entryIt->second.bytecode;
+                source.contentHash = entryIt->second.file_info.content_hash;
+                source.group = static_cast<uint32>(group);
+                source.dependencies = entryIt->second.dependencies;
+                source.debugInfo = entryIt->second.debug_info;
+            }
+        }
+    };
+
+    addPlan(generation->extensionsPlan);
+    addPlan(generation->scriptsPlan);
+
+    std::string manifest;
+    EclipseCache::ReadScriptFile(folderPrefix + SCRIPT_MANIFEST_FILE, manifest);
+
+    std::string error;
+    if (!EclipseScriptBundle::Write(bundlePath, sources, manifest, EclipseCache::GetInstance().IsStripBytecode(), error))
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Unable to write script bundle `{}`: {}", bundlePath, error);
+        return false;
+    }
+
+    ECLIPSE_LOG_INFO("[Eclipse]: Wrote {} scripts to bundle `{}`", sources.size(), bundlePath);
+    return true;
+}
+
+/**
+ * Builds on a copy of the published generation, states keep running it until the result is published
+ */
+bool EclipseScriptLoader::ReloadScripts(const ScriptChanges& changes)
+{
+    EclipseCache& eclipseCache = EclipseCache::GetInstance();
+
+    if (changes.fullRescan)
+    {
+        eclipseCache.SetCacheState(SCRIPT_CACHE_REINIT);
+        return LoadScriptPaths();
+    }
+
+    if (eclipseCache.GetCacheState() != SCRIPT_CACHE_READY)
+        return false;
+
+    eclipseCache.SetCacheState(SCRIPT_CACHE_LOADING);
+
+    std::lock_guard<std::mutex> buildGuard(lua_buildLock);
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    std::shared_ptr<const ScriptGeneration> current = GetGeneration();
+    lua_extensionsMap = current->extensions;
+    lua_scriptsMap = current->scripts;
+
+    std::vector<LuaScript> scripts;
+    for (const std::string& filePath : changes.paths)
+    {
+        RemoveScript(filePath);
+
+        boost::filesystem::path path(filePath);
+        if (boost::filesystem::is_regular_file(path))
+            ProcessScript(path.filename().generic_string(), filePath, scripts);
+        else
+            eclipseCache.InvalidateScript(filePath);
     }
+
+    CompileScripts(scripts);
+    BuildExecutionPlans();
+    PublishGeneration(false, changes.paths);
+
+    const auto& config = EclipseConfig::GetInstance();
+    if (config.IsByteCodeCacheEnabled())
+        eclipseCache.SaveToDisk(std::string(config.GetByteCodeCachePath()));
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
+
+    ECLIPSE_LOG_INFO("[Eclipse]: Reloaded {} changed scripts in {} µs", changes.paths.size(), static_cast<uint32>(duration));
+
+    eclipseCache.SetCacheState(SCRIPT_CACHE_READY);
     return true;
 }
 
 /**
  *
  */
-void EclipseScriptLoader::ProcessScript(sol::state& tempstate, const std::string& filename, const std::string& fullpath)
+void EclipseScriptLoader::CompileScript(ScriptCompileContext& context, const LuaScript& script, ScriptCompileResult& result)
+{
+    result.success = true;
+    bool isMoonScript = script.fileExt == ".moon";
+    if(!isMoonScript && script.fileExt != ".lua" && script.fileExt != ".ext")
+        return;
+
+    auto& cache = EclipseCache::GetInstance();
+    bool hasFileInfo = EclipseCache::GetFileInfo(script.filePath, result.fileInfo);
+    if (hasFileInfo && cache.IsFileInfoCurrent(script.filePath, result.fileInfo))
+    {
+        EclipseMetrics::GetInstance().Increment(METRIC_SCRIPTS_UP_TO_DATE);
+        return;
+    }
+
+    std::string source;
+    if (!hasFileInfo || !EclipseCache::ReadScriptFile(script.filePath, source))
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Unable to read script `{}`", script.filePath);
+        result.success = false;
+        return;
+    }
+
+    result.fileInfo.content_hash = EclipseHash::Compute(source);
+    result.refreshFileInfo = true;
+
+    // Only the metadata moved (checkout, rsync, touch), the cached bytecode is still valid
+    if (cache.IsContentCached(script.filePath, result.fileInfo.content_hash))
+    {
+        EclipseMetrics::GetInstance().Increment(METRIC_SCRIPTS_UP_TO_DATE);
+        return;
+    }
+
+    result.dependencies = EclipseCompiler::GetRequiredModules(source);
+
+    if (isMoonScript)
+    {
+        if (!context.moonState && !context.moonUnavailable)
+        {
+            context.moonState = EclipseCompiler::CreateMoonCompilerState(lua_requirepath, lua_requirecpath);
+            context.moonUnavailable = !context.moonState;
+        }
+
+        if (context.moonState)
+            result.bytecode = EclipseCompiler::CompileMoonToByteCode(*context.moonState, script.filePath, source);
+    }
+    else
+    {
+        // MoonScript keeps its debug info, its lines only match the generated Lua anyway
+        result.bytecode = EclipseCompiler::CompileLuaToByteCode(context.luaState, script.filePath, source, cache.IsStripBytecode() ? &result.debugInfo : nullptr);
+    }
+
+    result.success = result.bytecode.has_value();
+}
+
+/**
+ *
+ */
+void EclipseScriptLoader::CompileScripts(std::vector<LuaScript>& scripts)
+{
+    if (scripts.empty())
+        return;
+
+    uint32 threadCount = EclipseConfig::GetInstance().GetCompilerThreads();
+    if (!threadCount)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    threadCount = std::min<uint32>(threadCount, scripts.size());
+
+    std::vector<ScriptCompileResult> results(scripts.size());
+    std::atomic<std::size_t> nextScript = 0;
+
+    // Each worker owns its compiler state, scripts are handed out one at a time so a few
+    // large files do not leave the other workers idle. The cache is only read here.
+    auto worker = [&]()
+    {
+        ScriptCompileContext context;
+        context.luaState.open_libraries(
+            sol::lib::base,
+            sol::lib::package
+        );
+
+        for (std::size_t i = nextScript++; i < scripts.size(); i = nextScript++)
+        {
+            try
+            {
+                CompileScript(context, scripts[i], results[i]);
+            }
+            catch (const std::exception& e)
+            {
+                ECLIPSE_LOG_ERROR("[Eclipse]: Failed to compile script '{}': {}", scripts[i].filePath, e.what());
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threadCount - 1);
+    for (uint32 i = 1; i < threadCount; ++i)
+        workers.emplace_back(worker);
+
+    worker();
+
+    for (std::thread& thread : workers)
+        thread.join();
+
+    // Publish every recompiled script as a single cache generation
+    EclipseCache::GetInstance().Update([&](EclipseCache::CacheMap& cache)
+    {
+        for (std::size_t i = 0; i < scripts.size(); ++i)
+        {
+            ScriptCompileResult& result = results[i];
+            if (result.bytecode.has_value())
+            {
+                CacheEntry& entry = cache[scripts[i].filePath];
+                entry = CacheEntry(ScriptBytecode::Create(std::move(result.bytecode.value())), result.fileInfo, std::move(result.dependencies));
+                entry.debug_info = std::move(result.debugInfo);
+            }
+            else if (result.refreshFileInfo)
+            {
+                auto it = cache.find(scripts[i].filePath);
+                if (it != cache.end())
+                    it->second.file_info = result.fileInfo;
+            }
+        }
+    });
+
+    // Merge in discovery order so name collisions resolve exactly as a serial walk would
+    for (std::size_t i = 0; i < scripts.size(); ++i)
+        if (results[i].success)
+            AddScript(std::move(scripts[i]));
+
+    ECLIPSE_LOG_DEBUG("[Eclipse]: Compiled {} scripts using {} threads", scripts.size(), threadCount);
+}
+
+/**
+ *
+ */
+void EclipseScriptLoader::BuildExecutionPlans()
+{
+    BuildExecutionPlan(lua_extensionsMap, lua_extensionsPlan);
+    BuildExecutionPlan(lua_scriptsMap, lua_scriptsPlan);
+
+    ECLIPSE_LOG_DEBUG("[Eclipse]: Built execution plans, {} extension groups and {} script groups",
+        lua_extensionsPlan.GetGroupCount(), lua_scriptsPlan.GetGroupCount());
+}
+
+/**
+ * Kahn's algorithm over the required (cached static analysis) and declared (manifest) dependencies,
+ * one level at a time so every level is a group. Modules outside of the map are ignored: extensions
+ * always run before scripts and anything else is resolved by the default searchers.
+ */
+void EclipseScriptLoader::BuildExecutionPlan(const ScriptMap& scripts, ScriptExecutionPlan& plan)
+{
+    plan.Clear();
+
+    // Sorted by name so the plan never depends on hash order
+    std::vector<const LuaScript*> nodes;
+    nodes.reserve(scripts.size());
+    for (const auto& [fileName, script] : scripts)
+        nodes.push_back(&script);
+
+    std::sort(nodes.begin(), nodes.end(), [](const LuaScript* left, const LuaScript* right) { return left->fileName < right->fileName; });
+
+    std::unordered_map<std::string_view, std::size_t> nodeIndex;
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+        nodeIndex.emplace(nodes[i]->fileName, i);
+
+    std::vector<std::vector<std::size_t>> dependents(nodes.size());
+    std::vector<uint32> pendingDependencies(nodes.size(), 0);
+
+    auto addDependency = [&](std::size_t node, const std::string& moduleName)
+    {
+        auto it = nodeIndex.find(moduleName);
+        if (it == nodeIndex.end() || it->second == node)
+            return;
+
+        dependents[it->second].push_back(node);
+        ++pendingDependencies[node];
+    };
+
+    EclipseCache::CacheSnapshot snapshot = EclipseCache::GetInstance().GetSnapshot();
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        auto entryIt = snapshot->find(nodes[i]->filePath);
+        if (entryIt != snapshot->end())
+            for (const std::string& moduleName : entryIt->second.dependencies)
+                addDependency(i, moduleName);
+
+        auto declaredIt = lua_scriptDependencies.find(nodes[i]->fileName);
+        if (declaredIt != lua_scriptDependencies.end())
+            for (const std::string& moduleName : declaredIt->second)
+                addDependency(i, moduleName);
+    }
+
+    std::vector<std::size_t> group;
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+        if (!pendingDependencies[i])
+            group.push_back(i);
+
+    plan.order.reserve(nodes.size());
+    while (!group.empty())
+    {
+        plan.groupOffsets.push_back(plan.order.size());
+
+        std::vector<std::size_t> nextGroup;
+        for (std::size_t node : group)
+        {
+            plan.order.push_back(nodes[node]);
+            for (std::size_t dependent : dependents[node])
+                if (!--pendingDependencies[dependent])
+                    nextGroup.push_back(dependent);
+        }
+
+        std::sort(nextGroup.begin(), nextGroup.end());
+        group.swap(nextGroup);
+    }
+
+    // Cycles keep their require based behavior, they run last in name order
+    if (plan.order.size() < nodes.size())
+    {
+        // Dependents of a leftover script are leftovers too, a script is on a cycle if it reaches itself
+        std::vector<bool> visited(nodes.size());
+        std::vector<std::size_t> stack;
+        auto isOnCycle = [&](std::size_t start)
+        {
+            std::fill(visited.begin(), visited.end(), false);
+            stack.assign(dependents[start].begin(), dependents[start].end());
+            while (!stack.empty())
+            {
+                std::size_t node = stack.back();
+                stack.pop_back();
+                if (node == start)
+                    return true;
+
+                if (visited[node])
+                    continue;
+
+                visited[node] = true;
+                stack.insert(stack.end(), dependents[node].begin(), dependents[node].end());
+            }
+
+            return false;
+        };
+
+        plan.groupOffsets.push_back(plan.order.size());
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+        {
+            if (!pendingDependencies[i])
+                continue;
+
+            bool onCycle = isOnCycle(i);
+            ECLIPSE_LOG_WARN("[Eclipse]: Script `{}` is {} a dependency cycle", nodes[i]->filePath, onCycle ? "part of" : "blocked by");
+
+            plan.order.push_back(nodes[i]);
+        }
+    }
+
+    plan.groupOffsets.push_back(plan.order.size());
+}
+
+/**
+ *
+ */
+void EclipseScriptLoader::AddScript(LuaScript&& script)
+{
+    bool isExtension = script.fileExt == ".ext";
+    ECLIPSE_LOG_DEBUG("[Eclipse]: Added script: {} (extension: {})", script.filePath, isExtension);
+
+    if (isExtension)
+        lua_extensionsMap[script.fileName] = std::move(script);
+    else
+        lua_scriptsMap[script.fileName] = std::move(script);
+}
+
+/**
+ *
+ */
+void EclipseScriptLoader::RemoveScript(const std::string& filePath)
+{
+    auto removeFrom = [&filePath](ScriptMap& scriptMap)
+    {
+        for (auto it = scriptMap.begin(); it != scriptMap.end(); )
+        {
+            if (it->second.filePath == filePath)
+                it = scriptMap.erase(it);
+            else
+                ++it;
+        }
+    };
+
+    removeFrom(lua_extensionsMap);
+    removeFrom(lua_scriptsMap);
+}
+
+/**
+ *
+ */
+void EclipseScriptLoader::ProcessScript(const std::string& filename, const std::string& fullpath, std::vector<LuaScript>& scripts)
 {
     ECLIPSE_LOG_DEBUG("[Eclipse]: Processing script: {}", fullpath);
 
@@ -131,18 +885,11 @@ void EclipseScriptLoader::ProcessScript(sol::state& tempstate, const std::string
             return;
 
         std::string scriptName = filename.substr(0, extDot);
-        LuaScript script(std::move(ext), std::move(scriptName), fullpath);
-
-        if(!CompileScript(tempstate, script))
-            return;
+        LuaScript& script = scripts.emplace_back(std::move(ext), std::move(scriptName), fullpath);
 
-        bool isExtension = script.fileExt == ".ext";
-        if (isExtension)
-            lua_extensionsMap[script.fileName] = std::move(script);
-        else
-            lua_scriptsMap[script.fileName] = std::move(script);
-        
-        ECLIPSE_LOG_DEBUG("[Eclipse]: Added script: {} (extension: {})", fullpath, isExtension);
+        auto scopeIt = lua_scriptScopes.find(script.fileName);
+        if (scopeIt != lua_scriptScopes.end())
+            script.scope = scopeIt->second;
     }
     catch(const std::exception& e)
     {
@@ -153,7 +900,7 @@ void EclipseScriptLoader::ProcessScript(sol::state& tempstate, const std::string
 /**
  *
  */
-void EclipseScriptLoader::GetScripts(sol::state& tempState, const std::string& path)
+void EclipseScriptLoader::GetScripts(const std::string& path, std::vector<LuaScript>& scripts)
 {
     ECLIPSE_LOG_DEBUG("[Eclipse]: GetScripts from path `{}`", path);
 
@@ -185,14 +932,14 @@ void EclipseScriptLoader::GetScripts(sol::state& tempState, const std::string& p
                 // load subfolder
                 if (boost::filesystem::is_directory(dir_iter->status()))
                 {
-                    GetScripts(tempState, fullpath);
+                    GetScripts(fullpath, scripts);
                     continue;
                 }
 
                 if (boost::filesystem::is_regular_file(dir_iter->status()))
                 {
                     std::string fileName = dir_iter->path().filename().generic_string();
-                    ProcessScript(tempState, fileName, fullpath);
+                    ProcessScript(fileName, fullpath, scripts);
                 }
             }
         }
@@ -8,19 +8,79 @@
 #define ECLIPSE_SCRIPT_LOADER_HPP
 
 #include "EclipseIncludes.hpp"
+#include "EclipseCache.hpp"
+#include "EclipseScriptWatcher.hpp"
 #include <boost/filesystem.hpp>
+#include <atomic>
+#include <istream>
+#include <memory>
+#include <mutex>
+
+enum ScriptMapType : uint8
+{
+    SCRIPT_MAP_TYPE_WORLD           = 0x01,
+    SCRIPT_MAP_TYPE_DUNGEON         = 0x02,
+    SCRIPT_MAP_TYPE_RAID            = 0x04,
+    SCRIPT_MAP_TYPE_BATTLEGROUND    = 0x08,
+    SCRIPT_MAP_TYPE_ARENA           = 0x10,
+
+    SCRIPT_MAP_TYPE_ALL             = 0x1F
+};
+
+// Where a script runs, declared in the script manifest. Scripts without an entry run everywhere.
+struct ScriptScope
+{
+    bool lazy = false;
+    uint8 mapTypes = SCRIPT_MAP_TYPE_ALL;
+    std::unordered_set<uint32> mapIds;
+
+    bool IsGlobal() const { return mapTypes == SCRIPT_MAP_TYPE_ALL && mapIds.empty(); }
+    bool AppliesTo(const Map* map) const;
+};
 
 struct LuaScript
 {
     std::string fileExt;
     std::string fileName;
     std::string filePath;
+    ScriptScope scope;
 
     LuaScript() = default;
     LuaScript(std::string ext, std::string name, std::string path)
         : fileExt(std::move(ext)), fileName(std::move(name)), filePath(std::move(path)) {}
 };
 
+struct ScriptCompileResult
+{
+    bool success = false;
+    bool refreshFileInfo = false;
+    ScriptFileInfo fileInfo;
+    std::optional<sol::bytecode> bytecode;
+    std::vector<std::string> dependencies;
+    std::shared_ptr<const ScriptDebugInfo> debugInfo;
+};
+
+// Scripts in dependency order. Group i spans [groupOffsets[i], groupOffsets[i + 1]) and only
+// depends on earlier groups, the scripts inside a group are independent of each other.
+struct ScriptExecutionPlan
+{
+    std::vector<const LuaScript*> order;
+    std::vector<std::size_t> groupOffsets;
+
+    std::size_t GetGroupCount() const { return groupOffsets.empty() ? 0 : groupOffsets.size() - 1; }
+    void Clear() { order.clear(); groupOffsets.clear(); }
+};
+
+// Compiler states owned by a single compile worker, MoonScript is only loaded once a .moon file shows up
+struct ScriptCompileContext
+{
+    sol::state luaState;
+    std::unique_ptr<sol::state> moonState;
+    bool moonUnavailable = false;
+};
+
+struct ScriptGeneration;
+
 class EclipseScriptLoader
 {
     public:
@@ -29,18 +89,31 @@ class EclipseScriptLoader
         static bool IsValidScriptExtension(std::string& extension);
 
         static bool LoadScriptPaths();
-        static void ProcessScript(sol::state& tempstate, const std::string& filename, const std::string& fullpath);
-        static void GetScripts(sol::state& tempState, const std::string& path);
+        static bool ReloadScripts(const ScriptChanges& changes);
+        static void ProcessScript(const std::string& filename, const std::string& fullpath, std::vector<LuaScript>& scripts);
+        static void GetScripts(const std::string& path, std::vector<LuaScript>& scripts);
 
-        static bool CompileScript(sol::state& tempState, LuaScript& script);
+        static void CompileScripts(std::vector<LuaScript>& scripts);
+        static void CompileScript(ScriptCompileContext& context, const LuaScript& script, ScriptCompileResult& result);
+        static void AddScript(LuaScript&& script);
+        static void RemoveScript(const std::string& filePath);
 
-        static const std::string& GetLuaRequirePath()       { return lua_requirepath; }
-        static const std::string& GetLuaRequireCPath()      { return lua_requirecpath; }
-        static const std::string& GetLuaFolderPath()        { return lua_folderpath; }
-        static const ScriptMap& GetLuaExtensionsMap()       { return lua_extensionsMap; }
-        static const ScriptMap& GetLuaScriptsMap()          { return lua_scriptsMap; }
+        // Last published generation, never null. States keep the one they run until their next tick.
+        static std::shared_ptr<const ScriptGeneration> GetGeneration() { return lua_generation.load(std::memory_order_acquire); }
 
         static void ClearLuaScriptPaths();
+        static void PublishGeneration(bool fullReload, std::unordered_set<std::string> changedPaths = {});
+
+        static void BuildExecutionPlans();
+        static void BuildExecutionPlan(const ScriptMap& scripts, ScriptExecutionPlan& plan);
+
+        static void LoadScriptManifest();
+        static void ParseScriptManifest(std::istream& manifest);
+        static bool IsScriptManifest(const std::string& fileName);
+
+        // Bundles replace the directory walk and the compile step, see EclipseScriptBundle
+        static bool LoadScriptBundle(const std::string& bundlePath);
+        static bool WriteScriptBundle(const std::string& bundlePath);
 
     private:
         EclipseScriptLoader() = delete;
@@ -48,12 +121,51 @@ class EclipseScriptLoader
         EclipseScriptLoader(const EclipseScriptLoader&) = delete;
         EclipseScriptLoader& operator=(const EclipseScriptLoader&) = delete;
 
+        // Everything below is the generation being built, only touched under lua_buildLock
         static std::string lua_folderpath;
         static std::string lua_requirepath;
         static std::string lua_requirecpath;
 
         static ScriptMap lua_extensionsMap;
         static ScriptMap lua_scriptsMap;
+        static std::unordered_map<std::string, ScriptScope> lua_scriptScopes;
+        static std::unordered_map<std::string, std::vector<std::string>> lua_scriptDependencies;
+
+        static ScriptExecutionPlan lua_extensionsPlan;
+        static ScriptExecutionPlan lua_scriptsPlan;
+
+        static std::mutex lua_buildLock;
+        static std::atomic<std::shared_ptr<const ScriptGeneration>> lua_generation;
+};
+
+// One complete version of the scripts: maps, plans, require paths and the bytecode they were
+// compiled to. Reloads build the next one while states keep running theirs, each state moves
+// to the published one at its next tick and the last one to leave frees the old generation.
+struct ScriptGeneration
+{
+    uint32 id = 0;
+    uint32 baseId = 0;      // generation the changed paths are relative to
+    bool fullReload = true;
+    std::unordered_set<std::string> changedPaths;
+
+    std::string folderPath;
+    std::string requirePath;
+    std::string requireCPath;
+
+    EclipseScriptLoader::ScriptMap extensions;
+    EclipseScriptLoader::ScriptMap scripts;
+    ScriptExecutionPlan extensionsPlan; // point into the maps above
+    ScriptExecutionPlan scriptsPlan;
+    EclipseCache::CacheSnapshot bytecode;
+
+    ScriptGeneration() = default;
+    ScriptGeneration(const ScriptGeneration&) = delete;
+    ScriptGeneration& operator=(const ScriptGeneration&) = delete;
+
+    // Extensions shadow scripts of the same name
+    const LuaScript* FindModule(const std::string& moduleName) const;
+    ScriptBytecode GetBytecode(const std::string& filePath) const;
+    std::shared_ptr<const ScriptDebugInfo> GetDebugInfo(const std::string& filePath) const;
 };
 
 #endif // ECLIPSE_SCRIPT_LOADER_HPP
\ No newline at end of file
@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseScriptWatcher.hpp"
+#include "EclipseScriptLoader.hpp"
+#include "EclipseLogger.hpp"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(__linux__)
+    constexpr uint32 WATCH_MASK = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
+    constexpr int POLL_TIMEOUT_MS = 250;
+#endif
+}
+
+EclipseScriptWatcher& EclipseScriptWatcher::GetInstance()
+{
+    static EclipseScriptWatcher instance;
+    return instance;
+}
+
+EclipseScriptWatcher::~EclipseScriptWatcher()
+{
+    Stop();
+}
+
+/**
+ *
+ */
+bool EclipseScriptWatcher::Start(const std::string& rootPath, uint32 debounceMs)
+{
+    if (_running)
+        return true;
+
+#if defined(__linux__)
+    _inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_inotifyFd < 0)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Unable to initialize inotify, script auto reload disabled");
+        return false;
+    }
+
+    _debounce = std::chrono::milliseconds(debounceMs);
+    AddWatch(rootPath);
+
+    ECLIPSE_LOG_INFO("[Eclipse]: Watching {} directories under `{}` for script changes", _watches.size(), rootPath);
+
+    _running = true;
+    _thread = std::thread(&EclipseScriptWatcher::Run, this);
+    return true;
+#else
+    (void)rootPath;
+    (void)debounceMs;
+    ECLIPSE_LOG_WARN("[Eclipse]: Script auto reload is only supported on Linux");
+    return false;
+#endif
+}
+
+/**
+ *
+ */
+void EclipseScriptWatcher::Stop()
+{
+    if (!_running.exchange(false))
+        return;
+
+    if (_thread.joinable())
+        _thread.join();
+
+#if defined(__linux__)
+    close(_inotifyFd);
+#endif
+    _inotifyFd = -1;
+    _watches.clear();
+}
+
+/**
+ *
+ */
+bool EclipseScriptWatcher::TakeChanges(ScriptChanges& changes)
+{
+    std::lock_guard<std::mutex> guard(_pendingLock);
+    if (_pending.IsEmpty() || std::chrono::steady_clock::now() - _lastEvent < _debounce)
+        return false;
+
+    changes = std::move(_pending);
+    _pending = ScriptChanges();
+    return true;
+}
+
+/**
+ *
+ */
+void EclipseScriptWatcher::QueueChange(const std::string& path, bool rescan)
+{
+    std::lock_guard<std::mutex> guard(_pendingLock);
+    if (!path.empty())
+        _pending.paths.insert(path);
+
+    _pending.fullRescan |= rescan;
+    _lastEvent = std::chrono::steady_clock::now();
+}
+
+/**
+ *
+ */
+void EclipseScriptWatcher::AddWatch(const std::string& path)
+{
+#if defined(__linux__)
+    int wd = inotify_add_watch(_inotifyFd, path.c_str(), WATCH_MASK);
+    if (wd < 0)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Unable to watch script directory `{}`", path);
+        return;
+    }
+
+    _watches[wd] = path;
+
+    try
+    {
+        for (boost::filesystem::directory_iterator it(path), end; it != end; ++it)
+        {
+            std::string name = it->path().filename().generic_string();
+            if (!name.empty() && name[0] != '.' && boost::filesystem::is_directory(it->status()))
+                AddWatch(it->path().generic_string());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Exception when watching `{}`: {}", path, e.what());
+    }
+#else
+    (void)path;
+#endif
+}
+
+/**
+ *
+ */
+void EclipseScriptWatcher::Run()
+{
+#if defined(__linux__)
+    alignas(inotify_event) char buffer[16 * 1024];
+    pollfd pfd = { _inotifyFd, POLLIN, 0 };
+
+    while (_running)
+    {
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0)
+            continue;
+
+        ssize_t length;
+        while ((length = read(_inotifyFd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* ptr = buffer; ptr < buffer + length; )
+            {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+                ptr += sizeof(inotify_event) + event->len;
+
+                // Events were dropped, only a full walk can tell what changed
+                if (event->mask & IN_Q_OVERFLOW)
+                {
+                    QueueChange({}, true);
+                    continue;
+                }
+
+                auto it = _watches.find(event->wd);
+                if (it == _watches.end())
+                    continue;
+
+                if (event->mask & (IN_DELETE_SELF | IN_IGNORED))
+                {
+                    _watches.erase(it);
+                    continue;
+                }
+
+                if (!event->len || event->name[0] == '.')
+                    continue;
+
+                std::string fullpath = it->second + "/" + event->name;
+
+                // New folders change the require paths and may already hold scripts
+                if (event->mask & IN_ISDIR)
+                {
+                    if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                        AddWatch(fullpath);
+
+                    QueueChange({}, true);
+                    continue;
+                }
+
+                std::string name(event->name);
+                if (EclipseScriptLoader::IsScriptManifest(name))
+                {
+                    QueueChange({}, true);
+                    continue;
+                }
+
+                std::size_t extDot = name.find_last_of('.');
+                if (extDot == std::string::npos)
+                    continue;
+
+                std::string ext = name.substr(extDot);
+                if (EclipseScriptLoader::IsValidScriptExtension(ext))
+                    QueueChange(fullpath, false);
+            }
+        }
+    }
+#endif
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_SCRIPT_WATCHER_HPP
+#define ECLIPSE_SCRIPT_WATCHER_HPP
+
+#include "EclipseIncludes.hpp"
+
+#include <mutex>
+#include <thread>
+
+struct ScriptChanges
+{
+    std::unordered_set<std::string> paths;
+    bool fullRescan = false;
+
+    bool IsEmpty() const { return paths.empty() && !fullRescan; }
+};
+
+class EclipseScriptWatcher
+{
+    public:
+        static EclipseScriptWatcher& GetInstance();
+
+        bool Start(const std::string& rootPath, uint32 debounceMs);
+        void Stop();
+        bool IsRunning() const { return _running; }
+
+        // Hands out the pending changes once the tree has been quiet for the debounce window
+        bool TakeChanges(ScriptChanges& changes);
+
+    private:
+        EclipseScriptWatcher() = default;
+        ~EclipseScriptWatcher();
+        EclipseScriptWatcher(const EclipseScriptWatcher&) = delete;
+        EclipseScriptWatcher& operator=(const EclipseScriptWatcher&) = delete;
+
+        void Run();
+        void AddWatch(const std::string& path);
+        void QueueChange(const std::string& path, bool rescan);
+
+        std::thread _thread;
+        std::atomic<bool> _running = false;
+        int _inotifyFd = -1;
+        std::unordered_map<int, std::string> _watches;
+
+        std::mutex _pendingLock;
+        ScriptChanges _pending;
+        std::chrono::steady_clock::time_point _lastEvent;
+        std::chrono::milliseconds _debounce{ 0 };
+};
+
+#endif // ECLIPSE_SCRIPT_WATCHER_HPP
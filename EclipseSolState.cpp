@@ -9,14 +9,79 @@
 #include "EclipseLogger.hpp"
 #include "EclipseSolState.hpp"
 #include "EclipseCache.hpp"
+#include "EclipseCompiler.hpp"
+#include "EclipseConfig.hpp"
+#include "EclipseMetrics.hpp"
+#include "EclipseStateManager.hpp"
 
-EclipseSolState::EclipseSolState(Map* map) :
+#include <cstring>
+
+#ifdef SOL_LUAJIT
+#include <luajit.h>
+#endif
+
+namespace
+{
+    // Address used as the registry key pointing back to the EclipseSolState owning a Lua state
+    char STATE_REGISTRY_KEY;
+
+    // Same conversion as print, tostring is looked up on every call so scripts may replace it.
+    // Plain C function run under lua_pcall, it may raise while no C++ frame is on the way.
+    int ToLogString(lua_State* L)
+    {
+        lua_getglobal(L, "tostring");
+        lua_insert(L, 1);
+        lua_call(L, 1, 1);
+
+        if (!lua_isstring(L, -1))
+            return luaL_error(L, "'tostring' must return a string to be logged");
+
+        return 1;
+    }
+
+    // Errors of the conversion come back as sol::error, sol raises them once our frames are gone
+    void AppendLogValue(lua_State* L, int index, std::string& message)
+    {
+        lua_pushcfunction(L, ToLogString);
+        lua_pushvalue(L, index);
+        if (lua_pcall(L, 1, 1, 0) != LUA_OK)
+        {
+            const char* error = lua_tostring(L, -1);
+            std::string what = error ? error : "error object is not a string";
+            lua_pop(L, 1);
+            throw sol::error(what);
+        }
+
+        std::size_t length = 0;
+        const char* value = lua_tolstring(L, -1, &length);
+        message.append(value, length);
+        lua_pop(L, 1);
+    }
+
+    // { instructions = n, time = ms }, limits left out keep the defaults of the state
+    ExecutionLimits ReadExecutionLimits(const sol::optional<sol::table>& budget)
+    {
+        ExecutionLimits limits;
+        if (budget)
+        {
+            limits.instructions = budget->get_or<uint32>("instructions", 0);
+            limits.timeMs = budget->get_or<uint32>("time", 0);
+        }
+
+        return limits;
+    }
+}
+
+EclipseSolState::EclipseSolState(Map* map, bool runScripts) :
 _isInitialized(false),
 _solState(nullptr),
 _map(map)
 {
+    _mailbox = std::make_shared<EclipseMessageQueue>(EclipseConfig::GetInstance().GetMessageQueueSize());
+
+    // Anything published is complete, a reload being built does not hold new states back
     Initialize();
-    if(EclipseCache::GetInstance().GetCacheState() == SCRIPT_CACHE_READY)
+    if(runScripts && EclipseScriptLoader::GetGeneration()->id)
         RunScripts();
 }
 
@@ -28,6 +93,17 @@ bool EclipseSolState::IsInitialized() const
     return _isInitialized;
 }
 
+/**
+ *
+ */
+uint64 EclipseSolState::GetMemoryUsage() const
+{
+    if (_allocator)
+        return _allocator->GetUsedBytes();
+
+    return _solState.memory_used();
+}
+
 /**
  *
  */
@@ -38,7 +114,15 @@ bool EclipseSolState::Initialize()
 
     try
     {
+#ifdef SOL_LUAJIT
+        // LuaJIT manages its own memory, custom allocators are not supported on 64-bit builds
         _solState = sol::state();
+#else
+        uint64 memoryLimit = static_cast<uint64>(EclipseConfig::GetInstance().GetStateMemoryLimit()) * 1024 * 1024;
+        auto allocator = std::make_unique<EclipseAllocator>(memoryLimit);
+        _solState = sol::state(sol::default_at_panic, &EclipseAllocator::Allocate, allocator.get());
+        _allocator = std::move(allocator);
+#endif
         _solState.open_libraries(
             sol::lib::base,
             sol::lib::package,
@@ -56,40 +140,61 @@ bool EclipseSolState::Initialize()
 #endif
         );
 
-        _solState["package"]["path"] = EclipseScriptLoader::GetLuaRequirePath();
-        _solState["package"]["cpath"] = EclipseScriptLoader::GetLuaRequireCPath();
+        // Modules of the generation this state runs, package.path is set along with it
         _solState.add_package_loader([this](const std::string& moduleName) -> sol::object {
-            auto& cache = EclipseCache::GetInstance();
-            
-            const auto& extensionsMap = EclipseScriptLoader::GetLuaExtensionsMap();
-            auto extIt = extensionsMap.find(moduleName);
-            if (extIt != extensionsMap.end())
-            {
-                const LuaScript& script = extIt->second;
-                std::optional<sol::bytecode> byteCode = cache.GetBytecode(script.filePath);
-                if(byteCode.has_value())
-                {
-                    sol::load_result result = _solState.load(byteCode.value().as_string_view());
-                    if(result.valid()) return result;
-                }
-            }
-            
-            const auto& scriptsMap = EclipseScriptLoader::GetLuaScriptsMap();
-            auto scriptIt = scriptsMap.find(moduleName);
-            if (scriptIt != scriptsMap.end())
+            const LuaScript* script = _generation ? _generation->FindModule(moduleName) : nullptr;
+            if (script)
             {
-                const LuaScript& script = scriptIt->second;
-                std::optional<sol::bytecode> byteCode = cache.GetBytecode(script.filePath);
-                if(byteCode.has_value())
+                ScriptBytecode byteCode = _generation->GetBytecode(script->filePath);
+                if(byteCode)
                 {
-                    sol::load_result result = _solState.load(byteCode.value().as_string_view());
-                    if(result.valid()) return result;
+                    sol::load_result result = _solState.load(byteCode.GetView(), "@" + script->filePath, sol::load_mode::binary);
+                    if(result.valid())
+                    {
+                        EclipseMetrics::GetInstance().Increment(METRIC_REQUIRES_RESOLVED);
+                        return result;
+                    }
                 }
             }
-            
+
+            // Left to the default searchers, package.path and package.cpath
+            EclipseMetrics::GetInstance().Increment(METRIC_REQUIRES_UNRESOLVED);
             return sol::make_object(_solState, sol::lua_nil);
         });
 
+        lua_State* L = _solState.lua_state();
+        lua_pushlightuserdata(L, this);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &STATE_REGISTRY_KEY);
+
+        // The loader only runs for the first require of a module, the wrapper sees every one
+        lua_pushlightuserdata(L, this);
+        lua_getglobal(L, "require");
+        lua_pushcclosure(L, &EclipseSolState::Require, 2);
+        lua_setglobal(L, "require");
+
+        // Every protected call made from this state reports through it, event handlers included
+        sol::protected_function::set_default_handler(sol::make_object(_solState, &EclipseSolState::HandleError));
+
+        RegisterEventApi();
+        RegisterMessageApi();
+        RegisterLogApi();
+        RegisterMetricsApi();
+        _scheduler.Register(_solState);
+
+        const auto& config = EclipseConfig::GetInstance();
+        _hook.Attach(_solState.lua_state());
+        _budget.Initialize(_hook, { config.GetExecutionInstructionLimit(), config.GetExecutionTimeLimit() });
+        _events.SetBudget(&_budget);
+        _scheduler.SetBudget(&_budget);
+
+#ifdef SOL_LUAJIT
+        // Compiled traces never call the count hook, default limits would only hold in the interpreter
+        if (!_budget.GetDefaults().IsUnlimited())
+            luaJIT_setmode(_solState.lua_state(), 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+#endif
+
+        _garbageCollector.Initialize(_solState.lua_state(), EclipseGarbageCollector::ParseMode(config.GetGCMode()), config.GetGCStepBudget());
+
         _isInitialized = true;
 
         ECLIPSE_LOG_DEBUG("[Eclipse]: Sol state initialized successfully");
@@ -97,12 +202,31 @@ bool EclipseSolState::Initialize()
     }
     catch(const std::exception& e)
     {
-        ECLIPSE_LOG_ERROR("[Eclipse]: Error during creation of sol state: " + static_cast<std::string>(e.what()));
+        ECLIPSE_LOG_ERROR("[Eclipse]: Error during creation of sol state: {}", e.what());
     }
 
     return false;
 }
 
+/**
+ * Extensions do not depend on the map, pooled states run them before being handed to one
+ */
+void EclipseSolState::RunExtensions()
+{
+    if (!IsInitialized() || _extensionsLoaded)
+        return;
+
+    UseGeneration(EclipseScriptLoader::GetGeneration());
+
+    uint32 count = 0;
+    for (const LuaScript* script : _generation->extensionsPlan.order)
+        if (ShouldRunScript(*script) && ExecuteScript(*script))
+            count++;
+
+    _extensionsLoaded = true;
+    ECLIPSE_LOG_DEBUG("[Eclipse]: Executed {} Lua extensions", count);
+}
+
 /**
  *
  */
@@ -111,43 +235,591 @@ void EclipseSolState::RunScripts()
     if (!IsInitialized())
         return;
 
-    sol::state& solState = _solState;
-    auto startTime = std::chrono::high_resolution_clock::now();
+    EclipseMetricTimer runTimer(METRIC_STATE_RUN_TIME);
 
     const Map* map = GetMap();
     int32 mapId = map ? map->GetId() : -1;
     ECLIPSE_LOG_DEBUG("[Eclipse]: Running scripts for state: {}", mapId);
 
+    RunExtensions();
+
     uint32 count = 0;
-    auto& cache = EclipseCache::GetInstance();
+    for (const LuaScript* script : _generation->scriptsPlan.order)
+        if (ShouldRunScript(*script) && ExecuteScript(*script))
+            count++;
+
+    _lastRunTime = runTimer.GetElapsed();
+    PublishStats();
+    ECLIPSE_LOG_INFO("[Eclipse]: Executed {} Lua scripts in {} µs for map: {}", count, static_cast<uint32>(_lastRunTime), mapId);
+}
+
+/**
+ * Lazy scripts are only loaded through require, map scoped ones only run in the maps they target.
+ * Extensions run before a pooled state knows its map, so they only honor the lazy flag.
+ */
+bool EclipseSolState::ShouldRunScript(const LuaScript& script) const
+{
+    if (script.scope.lazy)
+        return false;
+
+    return script.fileExt == ".ext" || script.scope.AppliesTo(_map);
+}
 
-    auto executeScripts = [&](const auto& scriptMap) {
-        for (const auto& [fileName, script] : scriptMap)
+/**
+ *
+ */
+bool EclipseSolState::ExecuteScript(const LuaScript& script)
+{
+    try
+    {
+        ScriptBytecode byteCode = _generation->GetBytecode(script.filePath);
+        if(byteCode)
         {
-            try
+            auto result = _solState.load(byteCode.GetView(), "@" + script.filePath, sol::load_mode::binary);
+            if(result.valid())
             {
-                auto byteCode = cache.GetBytecode(script.filePath);
-                if(byteCode.has_value())
+                sol::protected_function chunk = result;
+                EclipseBudgetScope budgetScope(&_budget, script.filePath);
+                sol::protected_function_result callResult = chunk();
+                if (callResult.valid())
                 {
-                    auto result = solState.load(byteCode->as_string_view());
-                    if(result.valid())
-                    {
-                        result();
-                        count++;
-                    }
+                    EclipseMetrics::GetInstance().Increment(METRIC_SCRIPTS_EXECUTED);
+                    return true;
                 }
+
+                sol::error err = callResult;
+                ECLIPSE_LOG_ERROR("[Eclipse]: Error executing '{}': {}", script.filePath, err.what());
             }
-            catch (const sol::error& e)
+        }
+    }
+    catch (const sol::error& e)
+    {
+        ECLIPSE_LOG_ERROR("[Eclipse]: Error executing '{}': {}", script.filePath, e.what());
+    }
+
+    EclipseMetrics::GetInstance().Increment(METRIC_SCRIPT_ERRORS);
+    return false;
+}
+
+/**
+ * require(name) wrapped with the state and the original require as upvalues.
+ * Errors of the original propagate, nothing with a destructor is alive while it runs.
+ */
+int EclipseSolState::Require(lua_State* L)
+{
+    luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+
+    lua_pushvalue(L, lua_upvalueindex(2));
+    lua_pushvalue(L, 1);
+    lua_call(L, 1, LUA_MULTRET);
+
+    static_cast<EclipseSolState*>(lua_touserdata(L, lua_upvalueindex(1)))->RecordRequire(L, lua_tostring(L, 1));
+    return lua_gettop(L) - 1;
+}
+
+/**
+ * The requiring chunk is the first Lua frame loaded from a script file on the thread calling require
+ */
+void EclipseSolState::RecordRequire(lua_State* L, const std::string& moduleName)
+{
+    const LuaScript* script = _generation ? _generation->FindModule(moduleName) : nullptr;
+    if (!script)
+        return;
+
+    _requiredModules[script->filePath] = moduleName;
+
+    std::string requirer = GetCallingScript(L);
+    if (!requirer.empty() && requirer != script->filePath)
+        _dependents[script->filePath].insert(std::move(requirer));
+}
+
+/**
+ * Old generations stay alive for as long as a state holds on to them
+ */
+void EclipseSolState::UseGeneration(std::shared_ptr<const ScriptGeneration> generation)
+{
+    _generation = std::move(generation);
+    _solState["package"]["path"] = _generation->requirePath;
+    _solState["package"]["cpath"] = _generation->requireCPath;
+}
+
+/**
+ *
+ */
+uint32 EclipseSolState::GetScriptGeneration() const
+{
+    return _generation ? _generation->id : 0;
+}
+
+/**
+ * Path of the innermost Lua frame loaded from a script file, empty when called from C++ only
+ */
+std::string EclipseSolState::GetCallingScript(lua_State* L)
+{
+    lua_Debug ar;
+    for (int level = 0; lua_getstack(L, level, &ar); ++level)
+    {
+        if (lua_getinfo(L, "S", &ar) && ar.source && ar.source[0] == '@')
+            return ar.source + 1;
+    }
+
+    return {};
+}
+
+/**
+ * Line of a stripped frame from the side table of the generation the state runs, a newer one may
+ * already be published. -1 when unknown, `functionName` points into the generation.
+ */
+int32 EclipseSolState::GetStrippedLine(const lua_Debug& ar, const char*& functionName) const
+{
+    functionName = nullptr;
+    if (!_generation || !ar.source || ar.source[0] != '@')
+        return -1;
+
+    // Called from the message handler, nothing may be thrown back into Lua
+    try
+    {
+        std::shared_ptr<const ScriptDebugInfo> debugInfo = _generation->GetDebugInfo(ar.source + 1);
+        if (!debugInfo)
+            return -1;
+
+        if (ar.linedefined > 0)
+            if (const ScriptFunctionInfo* function = debugInfo->FindFunction(ar.linedefined))
+                functionName = function->name.c_str();
+
+        uint32 instruction, instructionCount;
+        if (!EclipseCompiler::GetCurrentInstruction(ar, instruction, instructionCount))
+            return -1;
+
+        return debugInfo->GetLine(ar.linedefined, ar.lastlinedefined, instructionCount, instruction);
+    }
+    catch (const std::exception&)
+    {
+        return -1;
+    }
+}
+
+/**
+ * Message handler of protected calls, the traceback of luaL_traceback with stripped frames decoded from
+ * the side table. Every Lua call here may raise, nothing with a destructor is alive across them.
+ */
+int EclipseSolState::HandleError(lua_State* L)
+{
+    // Same limits as luaL_traceback, deep stacks keep their first and last levels
+    constexpr int TRACEBACK_HEAD = 10;
+    constexpr int TRACEBACK_TAIL = 11;
+
+    const char* message = lua_tostring(L, 1);
+    if (!message)
+        return 1;
+
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &STATE_REGISTRY_KEY);
+    const EclipseSolState* state = static_cast<const EclipseSolState*>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+
+    lua_Debug ar;
+    int lastLevel = 1;
+    while (lua_getstack(L, lastLevel + 1, &ar))
+        ++lastLevel;
+
+    // Where the message was raised, the first Lua frame, a stripped one reports line -1 there
+    char errorSource[LUA_IDSIZE] = {};
+    int32 errorLine = -1;
+
+    luaL_Buffer traceback;
+    luaL_buffinit(L, &traceback);
+
+    int headLeft = lastLevel - 1 > TRACEBACK_HEAD + TRACEBACK_TAIL ? TRACEBACK_HEAD : -1;
+    for (int level = 1; lua_getstack(L, level, &ar); ++level)
+    {
+        if (headLeft-- == 0)
+        {
+            int skipped = lastLevel - level - TRACEBACK_TAIL + 1;
+            lua_pushfstring(L, "\n\t...\t(skipping %d levels)", skipped);
+            luaL_addvalue(&traceback);
+            level += skipped - 1;
+            continue;
+        }
+
+        lua_getinfo(L, "Slnt", &ar);
+        bool isLua = ar.what[0] != 'C';
+
+        const char* functionName = nullptr;
+        int32 line = ar.currentline;
+        if (isLua && line < 0 && state)
+            line = state->GetStrippedLine(ar, functionName);
+
+        if (isLua && !errorSource[0])
+        {
+            std::memcpy(errorSource, ar.short_src, sizeof(errorSource));
+            errorSource[sizeof(errorSource) - 1] = '\0';
+            errorLine = ar.currentline < 0 ? line : -1;
+        }
+
+        if (line > 0)
+            lua_pushfstring(L, "\n\t%s:%d: in ", ar.short_src, line);
+        else
+            lua_pushfstring(L, "\n\t%s: in ", ar.short_src);
+        luaL_addvalue(&traceback);
+
+        if (functionName)
+            lua_pushfstring(L, "function '%s'", functionName);
+        else if (ar.namewhat && ar.namewhat[0])
+            lua_pushfstring(L, "%s '%s'", ar.namewhat, ar.name);
+        else if (ar.what[0] == 'm')
+            lua_pushliteral(L, "main chunk");
+        else if (isLua)
+            lua_pushfstring(L, "function <%s:%d>", ar.short_src, ar.linedefined);
+        else
+            lua_pushliteral(L, "?");
+        luaL_addvalue(&traceback);
+
+        if (ar.istailcall)
+            luaL_addstring(&traceback, "\n\t(...tail calls...)");
+    }
+
+    luaL_pushresult(&traceback);
+
+    // Stripped bytecode raises its errors at `source:-1:`, the side table knows better
+    std::size_t sourceLength = std::strlen(errorSource);
+    if (errorLine > 0 && sourceLength && std::strncmp(message, errorSource, sourceLength) == 0 && std::strncmp(message + sourceLength, ":-1:", 4) == 0)
+        lua_pushfstring(L, "%s:%d:%s", errorSource, errorLine, message + sourceLength + 4);
+    else
+        lua_pushvalue(L, 1);
+
+    lua_pushliteral(L, "\nstack traceback:");
+    lua_pushvalue(L, -3);
+    lua_concat(L, 3);
+    return 1;
+}
+
+/**
+ * RegisterEvent(eventId, handler[, budget]), the budget table replaces the default execution limits
+ */
+void EclipseSolState::RegisterEventApi()
+{
+    sol::table events = _solState.create_named_table("Events");
+    for (uint16 eventId = 0; eventId < ECLIPSE_EVENT_COUNT; ++eventId)
+        events[EclipseEventRegistry::GetEventName(eventId)] = eventId;
+
+    _solState.set_function("RegisterEvent", [this](uint16 eventId, sol::protected_function handler, sol::optional<sol::table> budget, sol::this_state L) {
+        return _events.Register(eventId, std::move(handler), GetCallingScript(L), ReadExecutionLimits(budget));
+    });
+
+    _solState.set_function("UnregisterEvent", [this](EclipseEventRegistry::HandlerId handlerId) {
+        return _events.Unregister(handlerId);
+    });
+
+    _solState.set_function("ClearEvents", [this](uint16 eventId) {
+        _events.Clear(eventId);
+    });
+}
+
+/**
+ *
+ */
+void EclipseSolState::Update(uint32 diff)
+{
+    if (!IsInitialized())
+        return;
+
+    // Changes relative to the generation this state runs are reloaded in place, anything else
+    // (a rescan, a skipped generation, a state that never ran) reloads everything
+    std::shared_ptr<const ScriptGeneration> generation = EclipseScriptLoader::GetGeneration();
+    if (generation->id != GetScriptGeneration())
+    {
+        if (!generation->fullReload && _extensionsLoaded && generation->baseId == GetScriptGeneration())
+        {
+            UseGeneration(generation);
+            ReloadScripts(generation->changedPaths);
+        }
+        else
+            ReloadAllScripts();
+    }
+
+    DispatchMessages();
+    _scheduler.Update(diff);
+    _garbageCollector.Step();
+
+    PublishStats();
+}
+
+/**
+ *
+ */
+void EclipseSolState::PublishStats()
+{
+    _stats.memoryUsage.store(GetMemoryUsage(), std::memory_order_relaxed);
+    _stats.peakMemory.store(_allocator ? _allocator->GetPeakBytes() : 0, std::memory_order_relaxed);
+    _stats.lastRunTime.store(_lastRunTime, std::memory_order_relaxed);
+    _stats.gcMode.store(_garbageCollector.GetMode(), std::memory_order_relaxed);
+    _stats.gcStepSize.store(_garbageCollector.GetStepSize(), std::memory_order_relaxed);
+}
+
+/**
+ * At most one queue worth of messages per tick, replies sent to this state wait for the next one
+ */
+uint32 EclipseSolState::DispatchMessages()
+{
+    if (!IsInitialized())
+        return 0;
+
+    lua_State* L = _solState.lua_state();
+    _dispatchingMessages = true;
+
+    uint32 delivered = 0;
+    EclipseMessage message;
+    for (std::size_t budget = _mailbox->GetCapacity(); budget && _mailbox->Pop(message); --budget)
+    {
+        sol::object value;
+        bool decoded = false;
+
+        // Handlers registered while dispatching only see later messages
+        for (std::size_t i = 0, count = _messageHandlers.size(); i < count; ++i)
+        {
+            if (!_messageHandlers[i].id || _messageHandlers[i].channel != message.channel)
+                continue;
+
+            if (!decoded)
+            {
+                std::string error;
+                if (!EclipseMessageSerializer::Deserialize(L, *message.payload, error))
+                {
+                    ECLIPSE_LOG_ERROR("[Eclipse]: Dropped message on channel `{}` from state {}: {}", message.channel, message.sender, error);
+                    break;
+                }
+
+                value = sol::object(L, -1);
+                lua_pop(L, 1);
+                decoded = true;
+            }
+
+            sol::protected_function handler = _messageHandlers[i].function;
+            EclipseBudgetScope budgetScope(&_budget, _messageHandlers[i].owner, _messageHandlers[i].limits);
+            sol::protected_function_result result = handler(value, message.sender, message.channel, message.senderInstance);
+            if (!result.valid())
             {
-                ECLIPSE_LOG_ERROR("[Eclipse]: Error executing '{}': {}", script.filePath, e.what());
+                sol::error err = result;
+                ECLIPSE_LOG_ERROR("[Eclipse]: Error in message handler for `{}` registered by `{}`: {}", message.channel, _messageHandlers[i].owner, err.what());
             }
         }
+
+        ++delivered;
+    }
+
+    _dispatchingMessages = false;
+    std::erase_if(_messageHandlers, [](const MessageHandler& handler) { return !handler.id; });
+
+    return delivered;
+}
+
+/**
+ * SendMessage(target, channel, value[, instanceId]) and BroadcastMessage(channel, value), the global state is -1.
+ * Values are serialized on the sending thread, handlers get (value, sender, channel, senderInstance).
+ * RegisterMessageHandler(channel, handler[, budget]) takes the same budget table as RegisterEvent.
+ */
+void EclipseSolState::RegisterMessageApi()
+{
+    _solState["GLOBAL_STATE_ID"] = -1;
+
+    auto serialize = [](sol::this_state L, const sol::object& value, std::string& error) -> std::shared_ptr<const std::string> {
+        auto payload = std::make_shared<std::string>();
+        value.push(L);
+        bool serialized = EclipseMessageSerializer::Serialize(L, -1, *payload, error);
+        lua_pop(L, 1);
+        return serialized ? payload : nullptr;
+    };
+
+    _solState.set_function("SendMessage", [this, serialize](int32 target, const std::string& channel, sol::object value, sol::optional<uint32> instanceId, sol::this_state L)
+        -> std::tuple<bool, sol::optional<std::string>> {
+        std::string error;
+        std::shared_ptr<const std::string> payload = serialize(L, value, error);
+        if (!payload)
+            return { false, error };
+
+        EclipseMessage message{ _map ? static_cast<int32>(_map->GetId()) : -1, _map ? _map->GetInstanceId() : 0, channel, std::move(payload) };
+        if (!EclipseStateManager::GetInstance().PostMessage(target, instanceId.value_or(0), std::move(message)))
+            return { false, "state " + std::to_string(target) + " does not exist or its queue is full" };
+
+        return { true, sol::nullopt };
+    });
+
+    _solState.set_function("BroadcastMessage", [this, serialize](const std::string& channel, sol::object value, sol::this_state L)
+        -> std::tuple<uint32, sol::optional<std::string>> {
+        std::string error;
+        std::shared_ptr<const std::string> payload = serialize(L, value, error);
+        if (!payload)
+            return { 0, error };
+
+        EclipseMessage message{ _map ? static_cast<int32>(_map->GetId()) : -1, _map ? _map->GetInstanceId() : 0, channel, std::move(payload) };
+        return { EclipseStateManager::GetInstance().BroadcastMessage(message), sol::nullopt };
+    });
+
+    _solState.set_function("RegisterMessageHandler", [this](const std::string& channel, sol::protected_function handler, sol::optional<sol::table> budget, sol::this_state L) -> uint32 {
+        if (!handler.valid())
+            return 0;
+
+        _messageHandlers.push_back({ _nextMessageHandlerId++, channel, std::move(handler), GetCallingScript(L), ReadExecutionLimits(budget) });
+        return _messageHandlers.back().id;
+    });
+
+    _solState.set_function("UnregisterMessageHandler", [this](uint32 handlerId) {
+        for (MessageHandler& handler : _messageHandlers)
+        {
+            if (!handlerId || handler.id != handlerId)
+                continue;
+
+            handler.id = 0;
+            if (!_dispatchingMessages)
+                std::erase_if(_messageHandlers, [](const MessageHandler& entry) { return !entry.id; });
+            return true;
+        }
+
+        return false;
+    });
+}
+
+/**
+ * GetEngineReport() returns the lines of the metrics report, for GM commands written in Lua
+ */
+void EclipseSolState::RegisterMetricsApi()
+{
+    _solState.set_function("GetEngineReport", []() {
+        return sol::as_table(EclipseMetrics::GetInstance().GetReport());
+    });
+}
+
+/**
+ * print and Log.* go through the engine logger, rate limited per calling script
+ */
+void EclipseSolState::RegisterLogApi()
+{
+    _logLimiter.SetLimit(EclipseConfig::GetInstance().GetLogRateLimit());
+
+    auto log = [this](LogLevel level, sol::this_state L, const sol::variadic_args& args) {
+        if (!sLog->ShouldLog(ECLIPSE_LOG_FILTER, level))
+            return;
+
+        std::string script = GetCallingScript(L);
+        if (!_logLimiter.Allow(script))
+            return;
+
+        std::string message = script.empty() ? "[Eclipse]: " : "[Eclipse][" + script + "]: ";
+        for (std::size_t i = 0; i < args.size(); ++i)
+        {
+            if (i)
+                message.push_back('\t');
+
+            AppendLogValue(L, args.stack_index() + static_cast<int>(i), message);
+        }
+
+        EclipseLogger::GetInstance().Write(level, std::move(message));
     };
 
-    executeScripts(EclipseScriptLoader::GetLuaExtensionsMap());
-    executeScripts(EclipseScriptLoader::GetLuaScriptsMap());
+    _solState.set_function("print", [log](sol::this_state L, sol::variadic_args args) { log(LOG_LEVEL_INFO, L, args); });
+
+    sol::table logTable = _solState.create_named_table("Log");
+    logTable.set_function("Error", [log](sol::this_state L, sol::variadic_args args) { log(LOG_LEVEL_ERROR, L, args); });
+    logTable.set_function("Warn", [log](sol::this_state L, sol::variadic_args args) { log(LOG_LEVEL_WARN, L, args); });
+    logTable.set_function("Info", [log](sol::this_state L, sol::variadic_args args) { log(LOG_LEVEL_INFO, L, args); });
+    logTable.set_function("Debug", [log](sol::this_state L, sol::variadic_args args) { log(LOG_LEVEL_DEBUG, L, args); });
+    logTable.set_function("Trace", [log](sol::this_state L, sol::variadic_args args) { log(LOG_LEVEL_TRACE, L, args); });
+}
+
+/**
+ *
+ */
+void EclipseSolState::ClearMessageHandlers(const std::string& owner)
+{
+    for (MessageHandler& handler : _messageHandlers)
+        if (handler.owner == owner)
+            handler.id = 0;
+
+    if (!_dispatchingMessages)
+        std::erase_if(_messageHandlers, [](const MessageHandler& handler) { return !handler.id; });
+}
+
+/**
+ *
+ */
+void EclipseSolState::ReloadScripts(const std::unordered_set<std::string>& changedPaths)
+{
+    if (!IsInitialized() || !_generation)
+        return;
+
+    EclipseMetricTimer reloadTimer(METRIC_STATE_RELOAD_TIME);
+
+    // Changed files plus everything that transitively required them
+    std::unordered_set<std::string> affected(changedPaths);
+    std::vector<std::string> pending(changedPaths.begin(), changedPaths.end());
+    while (!pending.empty())
+    {
+        std::string filePath = std::move(pending.back());
+        pending.pop_back();
+
+        auto it = _dependents.find(filePath);
+        if (it == _dependents.end())
+            continue;
+
+        for (const std::string& dependent : it->second)
+            if (affected.insert(dependent).second)
+                pending.push_back(dependent);
+    }
+
+    sol::table loaded = _solState["package"]["loaded"];
+    for (const std::string& filePath : affected)
+    {
+        auto it = _requiredModules.find(filePath);
+        if (it == _requiredModules.end())
+            continue;
+
+        loaded[it->second] = sol::lua_nil;
+        _requiredModules.erase(it);
+    }
+
+    // Re-executed scripts register their handlers and timers again
+    for (const std::string& filePath : affected)
+    {
+        _events.ClearOwner(filePath);
+        _scheduler.ClearOwner(filePath);
+        ClearMessageHandlers(filePath);
+    }
+
+    uint32 count = 0;
+    auto executeAffected = [&](const ScriptExecutionPlan& plan) {
+        for (const LuaScript* script : plan.order)
+            if (affected.count(script->filePath) && ShouldRunScript(*script) && ExecuteScript(*script))
+                count++;
+    };
+
+    executeAffected(_generation->extensionsPlan);
+    executeAffected(_generation->scriptsPlan);
+
+    const Map* map = GetMap();
+    int32 mapId = map ? map->GetId() : -1;
+
+    ECLIPSE_LOG_INFO("[Eclipse]: Reloaded {} Lua scripts in {} µs for map: {}", count, static_cast<uint32>(reloadTimer.GetElapsed()), mapId);
+}
+
+/**
+ *
+ */
+void EclipseSolState::ReloadAllScripts()
+{
+    if (!IsInitialized())
+        return;
+
+    sol::table loaded = _solState["package"]["loaded"];
+    for (const auto& [filePath, moduleName] : _requiredModules)
+        loaded[moduleName] = sol::lua_nil;
+
+    _requiredModules.clear();
+    _dependents.clear();
+    _events.ClearAll();
+    _scheduler.ClearAll();
+    _messageHandlers.clear();
+    _extensionsLoaded = false;
 
-    auto endTime = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
-    ECLIPSE_LOG_INFO("[Eclipse]: Executed {} Lua scripts in {} µs for map: {}", count, static_cast<uint32>(duration), mapId);
+    RunScripts();
 }
\ No newline at end of file
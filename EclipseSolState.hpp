@@ -8,31 +8,135 @@
 #define ECLIPSE_SOL_STATE_HPP
 
 #include "EclipseIncludes.hpp"
+#include "EclipseAllocator.hpp"
+#include "EclipseEventRegistry.hpp"
+#include "EclipseExecutionBudget.hpp"
+#include "EclipseGarbageCollector.hpp"
+#include "EclipseHook.hpp"
+#include "EclipseLogger.hpp"
+#include "EclipseMessaging.hpp"
+#include "EclipseProfiler.hpp"
+#include "EclipseScheduler.hpp"
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+struct LuaScript;
+struct ScriptGeneration;
+
+// Published by the thread running the state at the end of its tick, the metrics report reads them
+// from any thread and never touches the Lua state itself
+struct EclipseStateStats
+{
+    std::atomic<uint64> memoryUsage{ 0 };
+    std::atomic<uint64> peakMemory{ 0 };    // 0 without a custom allocator
+    std::atomic<uint64> lastRunTime{ 0 };
+    std::atomic<uint8> gcMode{ GC_MODE_AUTO };
+    std::atomic<uint32> gcStepSize{ 0 };
+};
+
 class EclipseSolState
 {
     public:
-        EclipseSolState(Map* map);
+        explicit EclipseSolState(Map* map, bool runScripts = true);
         ~EclipseSolState() = default;
 
         bool Initialize();
         bool IsInitialized() const;
 
+        void RunExtensions();
         void RunScripts();
+        void ReloadScripts(const std::unordered_set<std::string>& changedPaths);
+        void ReloadAllScripts();
+
+        // Map update tick, moves to a newly published script generation, delivers queued messages,
+        // resumes the coroutines and timers that are due and spends what is left of the tick's GC budget
+        void Update(uint32 diff);
+        uint32 DispatchMessages();
 
         sol::state& GetState() { return _solState; }
         const sol::state& GetState() const { return _solState; }
 
         const Map* GetMap() const { return _map; }
+        void AttachMap(Map* map) { _map = map; }
+
+        uint32 GetScriptGeneration() const;
+        uint64 GetLastRunTime() const { return _lastRunTime; }
+        const EclipseStateStats& GetStats() const { return _stats; }
+
+        EclipseEventRegistry& GetEvents() { return _events; }
+        bool HasEvent(uint16 eventId) const { return _events.HasHandlers(eventId); }
+
+        EclipseScheduler& GetScheduler() { return _scheduler; }
+        EclipseGarbageCollector& GetGarbageCollector() { return _garbageCollector; }
+        const EclipseGarbageCollector& GetGarbageCollector() const { return _garbageCollector; }
+        const std::shared_ptr<EclipseMessageQueue>& GetMailbox() const { return _mailbox; }
+
+        EclipseProfiler& GetProfiler() { return _profiler; }
+        bool StartProfiler(uint32 instructionPeriod = EclipseProfiler::DEFAULT_INSTRUCTION_PERIOD, uint32 sampleIntervalUs = 0)
+        {
+            return _profiler.Start(_hook, instructionPeriod, sampleIntervalUs);
+        }
+
+        EclipseExecutionBudget& GetBudget() { return _budget; }
+        const EclipseExecutionBudget& GetBudget() const { return _budget; }
+
+        const EclipseAllocator* GetAllocator() const { return _allocator.get(); }
+        uint64 GetMemoryUsage() const;
+
+        static std::string GetCallingScript(lua_State* L);
+        static int HandleError(lua_State* L);
 
     private:
-        Map* const _map;
+        struct MessageHandler
+        {
+            uint32 id;
+            std::string channel;
+            sol::protected_function function;
+            std::string owner;
+            ExecutionLimits limits;
+        };
+
+        void RegisterEventApi();
+        void RegisterMessageApi();
+        void RegisterLogApi();
+        void RegisterMetricsApi();
+        void PublishStats();
+        void ClearMessageHandlers(const std::string& owner);
+        bool ShouldRunScript(const LuaScript& script) const;
+        bool ExecuteScript(const LuaScript& script);
+        static int Require(lua_State* L);
+        int32 GetStrippedLine(const lua_Debug& ar, const char*& functionName) const;
+        void RecordRequire(lua_State* L, const std::string& moduleName);
+        void UseGeneration(std::shared_ptr<const ScriptGeneration> generation);
+
+        Map* _map;
+        std::unique_ptr<EclipseAllocator> _allocator;
         sol::state _solState;
+        EclipseHook _hook;              // detached before the state closes, its clients before it
+        EclipseExecutionBudget _budget;
+        EclipseEventRegistry _events;
+        EclipseProfiler _profiler;
+        EclipseScheduler _scheduler;
+        EclipseGarbageCollector _garbageCollector;
+        EclipseLogRateLimiter _logLimiter;
+        std::shared_ptr<EclipseMessageQueue> _mailbox;
+        std::vector<MessageHandler> _messageHandlers;
+        uint32 _nextMessageHandlerId = 1;
+        bool _dispatchingMessages = false;
         bool _isInitialized;
+        bool _extensionsLoaded = false;
+        std::shared_ptr<const ScriptGeneration> _generation;
+        uint64 _lastRunTime = 0;
+        EclipseStateStats _stats;
+
+        // module file -> files that required it, and module file -> name it was required as
+        std::unordered_map<std::string, std::unordered_set<std::string>> _dependents;
+        std::unordered_map<std::string, std::string> _requiredModules;
 };
 
 #endif // ECLIPSE_SOL_STATE_HPP
\ No newline at end of file
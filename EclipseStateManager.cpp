@@ -11,6 +11,8 @@
 #include "EclipseIncludes.hpp"
 #include "EclipseConfig.hpp"
 #include "EclipseLogger.hpp"
+#include "EclipseMetrics.hpp"
+#include "EclipseStatePool.hpp"
 #include <chrono>
 
 /**
@@ -27,22 +29,218 @@ EclipseStateManager& EclipseStateManager::GetInstance()
  */
 EclipseSolState* EclipseStateManager::CreateState(Map* map)
 {
+    uint64 key = GetStateKey(map);
+    if (EclipseSolState* existing = FindState(key))
+        return existing;
+
     int32 mapId = map ? map->GetId() : -1;
-    auto [it, inserted] = _states.try_emplace(mapId, nullptr);
+    uint32 instanceId = map ? map->GetInstanceId() : 0;
+
+    // Claim a pre-warmed state when one is available, only the map scripts are left to run
+    std::unique_ptr<EclipseSolState> engine;
+    if (map)
+        engine = EclipseStatePool::GetInstance().Acquire();
+
+    if (engine)
+    {
+        engine->AttachMap(map);
+        engine->RunScripts();
+        ECLIPSE_LOG_DEBUG("Claimed pooled Lua state for map " + std::to_string(mapId) + " instance " + std::to_string(instanceId));
+    }
+    else
+    {
+        engine = std::make_unique<EclipseSolState>(map);
+        ECLIPSE_LOG_DEBUG("Creating new Lua state for map " + std::to_string(mapId) + " instance " + std::to_string(instanceId));
+    }
+
+    if(!engine->IsInitialized())
+        return nullptr;
+
+    // Scripts ran without holding the shard, a state created meanwhile for the same key wins
+    EclipseSolState* enginePtr;
+    {
+        StateShard& shard = GetShard(key);
+        std::unique_lock<std::shared_mutex> lock(shard.lock);
+        auto [it, inserted] = shard.states.try_emplace(key, std::move(engine));
+        if (!inserted)
+            return it->second.get();
+
+        enginePtr = it->second.get();
+    }
+
+    RegisterMailbox(key, enginePtr->GetMailbox());
+    EclipseMetrics::GetInstance().Increment(METRIC_STATES_CREATED);
+    return enginePtr;
+}
+
+/**
+ *
+ */
+EclipseSolState* EclipseStateManager::FindState(uint64 key) const
+{
+    const StateShard& shard = GetShard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.lock);
+
+    auto it = shard.states.find(key);
+    return it != shard.states.end() ? it->second.get() : nullptr;
+}
+
+/**
+ * The state is closed after leaving the shard, lookups from other threads are not held up by it
+ */
+bool EclipseStateManager::DestroyState(uint64 key)
+{
+    std::unique_ptr<EclipseSolState> state;
+    {
+        StateShard& shard = GetShard(key);
+        std::unique_lock<std::shared_mutex> lock(shard.lock);
+
+        auto it = shard.states.find(key);
+        if (it == shard.states.end())
+            return false;
+
+        state = std::move(it->second);
+        shard.states.erase(it);
+    }
+
+    UnregisterMailbox(key);
+    state.reset();
+
+    EclipseMetrics::GetInstance().Increment(METRIC_STATES_DESTROYED);
+    ECLIPSE_LOG_DEBUG("Destroyed Lua state for map " + std::to_string(static_cast<int32>(key >> 32)) + " instance " + std::to_string(static_cast<uint32>(key)));
+    return true;
+}
+
+/**
+ *
+ */
+uint32 EclipseStateManager::GetStateCount() const
+{
+    uint32 count = 0;
+    for (const StateShard& shard : _shards)
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.lock);
+        count += static_cast<uint32>(shard.states.size());
+    }
+
+    return count;
+}
+
+/**
+ *
+ */
+bool EclipseStateManager::PostMessage(int32 mapId, uint32 instanceId, EclipseMessage&& message) const
+{
+    std::shared_ptr<const MailboxMap> mailboxes = _mailboxes.load(std::memory_order_acquire);
+    auto it = mailboxes->find(MakeStateKey(mapId, instanceId));
+    if (it == mailboxes->end())
+        return false;
+
+    if (!it->second->Push(std::move(message)))
+    {
+        EclipseMetrics::GetInstance().Increment(METRIC_MESSAGES_DROPPED);
+        return false;
+    }
 
-    if(!inserted)
-        return it->second.get();
+    EclipseMetrics::GetInstance().Increment(METRIC_MESSAGES_SENT);
+    return true;
+}
+
+/**
+ * Every state but the sender, the payload buffer is shared
+ */
+uint32 EclipseStateManager::BroadcastMessage(const EclipseMessage& message) const
+{
+    std::shared_ptr<const MailboxMap> mailboxes = _mailboxes.load(std::memory_order_acquire);
 
-    auto engine = std::make_unique<EclipseSolState>(map);
-    ECLIPSE_LOG_DEBUG("Creating new Lua state for map " + std::to_string(mapId));
+    uint64 senderKey = MakeStateKey(message.sender, message.senderInstance);
 
-    if(engine->IsInitialized())
+    uint32 delivered = 0;
+    for (const auto& [key, mailbox] : *mailboxes)
     {
-        EclipseSolState* enginePtr = engine.get();
-        it->second = std::move(engine);
-        return enginePtr;
+        if (key == senderKey)
+            continue;
+
+        EclipseMessage copy(message);
+        if (mailbox->Push(std::move(copy)))
+            ++delivered;
+        else
+            EclipseMetrics::GetInstance().Increment(METRIC_MESSAGES_DROPPED);
     }
 
-    _states.erase(it);
-    return nullptr;
+    EclipseMetrics::GetInstance().Increment(METRIC_MESSAGES_SENT, delivered);
+    return delivered;
+}
+
+/**
+ *
+ */
+void EclipseStateManager::RegisterMailbox(uint64 key, std::shared_ptr<EclipseMessageQueue> mailbox)
+{
+    std::lock_guard<std::mutex> guard(_mailboxesLock);
+    auto next = std::make_shared<MailboxMap>(*_mailboxes.load(std::memory_order_acquire));
+    (*next)[key] = std::move(mailbox);
+    _mailboxes.store(std::move(next), std::memory_order_release);
+}
+
+/**
+ * Senders holding the previous snapshot may still push, the queue lives until they let go of it
+ */
+void EclipseStateManager::UnregisterMailbox(uint64 key)
+{
+    std::lock_guard<std::mutex> guard(_mailboxesLock);
+    auto next = std::make_shared<MailboxMap>(*_mailboxes.load(std::memory_order_acquire));
+    next->erase(key);
+    _mailboxes.store(std::move(next), std::memory_order_release);
+}
+
+/**
+ * Map update hook, runs on the thread updating the map
+ */
+void EclipseStateManager::UpdateMap(Map* map, uint32 diff)
+{
+    if (EclipseSolState* state = FindState(GetStateKey(map)))
+        state->Update(diff);
+}
+
+/**
+ * World tick entry point, picks up script changes reported by the watcher.
+ * The next generation is built off the world thread, states switch to it at their own tick.
+ */
+void EclipseStateManager::Update(uint32 diff)
+{
+    // The global state has no map, it ticks with the world
+    if (EclipseSolState* globalState = GetGlobalState())
+        globalState->Update(diff);
+
+    const auto& config = EclipseConfig::GetInstance();
+
+    EclipseLogger& logger = EclipseLogger::GetInstance();
+    if (!logger.IsRunning() && config.IsAsyncLogEnabled())
+        logger.Start(config.GetLogBufferSize());
+
+    EclipseStatePool& statePool = EclipseStatePool::GetInstance();
+    if (!statePool.IsRunning() && config.GetStatePoolSize() && EclipseCache::GetInstance().GetCacheState() == SCRIPT_CACHE_READY)
+        statePool.Start(config.GetStatePoolSize(), config.GetStatePoolRefillThreshold());
+
+    if (!config.IsAutoReloadEnabled())
+        return;
+
+    // One build at a time, changes reported meanwhile wait in the watcher
+    if (_reload.valid())
+    {
+        if (_reload.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            return;
+
+        if (_reload.get())
+            statePool.Flush();
+    }
+
+    ScriptChanges changes;
+    if (!EclipseScriptWatcher::GetInstance().TakeChanges(changes))
+        return;
+
+    _reload = std::async(std::launch::async, [changes = std::move(changes)]() {
+        return EclipseScriptLoader::ReloadScripts(changes);
+    });
 }
\ No newline at end of file
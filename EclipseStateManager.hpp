@@ -10,27 +10,90 @@
 #include "EclipseIncludes.hpp"
 #include "EclipseSolState.hpp"
 
+#include <array>
+#include <future>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 
+// States are keyed by map and instance, the global state is map -1. The registry is split in
+// shards with their own lock so map threads creating, finding and destroying states rarely meet.
+// A returned state stays valid until it is destroyed, which only the thread owning its map does.
 class EclipseStateManager
 {
     public:
         static EclipseStateManager& GetInstance();
 
+        static uint64 MakeStateKey(int32 mapId, uint32 instanceId) { return (uint64(uint32(mapId)) << 32) | instanceId; }
+        static uint64 GetStateKey(const Map* map) { return map ? MakeStateKey(map->GetId(), map->GetInstanceId()) : MakeStateKey(-1, 0); }
+
         EclipseSolState* CreateState(Map* map);
 
-        EclipseSolState* GetGlobalState() { return _states[-1].get(); };
-        EclipseSolState* GetStateByMap(Map* map) { return _states[map->GetId()].get();  }
-        EclipseSolState* GetStateByMapId(int32 mapId) { return _states[mapId].get(); }
+        // Instance unload, the state is closed on the calling thread
+        bool DestroyState(Map* map) { return DestroyState(GetStateKey(map)); }
+        bool DestroyState(int32 mapId, uint32 instanceId) { return DestroyState(MakeStateKey(mapId, instanceId)); }
+
+        void Update(uint32 diff);
+        void UpdateMap(Map* map, uint32 diff);
+
+        // Lookups never create a state
+        EclipseSolState* GetGlobalState() const { return FindState(MakeStateKey(-1, 0)); }
+        EclipseSolState* GetStateByMap(const Map* map) const { return FindState(GetStateKey(map)); }
+        EclipseSolState* GetStateByMapId(int32 mapId, uint32 instanceId = 0) const { return FindState(MakeStateKey(mapId, instanceId)); }
+
+        uint32 GetStateCount() const;
+
+        // Safe from any map thread, messages are delivered when the receiving state ticks
+        bool PostMessage(int32 mapId, uint32 instanceId, EclipseMessage&& message) const;
+        uint32 BroadcastMessage(const EclipseMessage& message) const;
+
+        // Each shard is locked shared while its states are visited
+        template<typename Fn>
+        void ForEachState(Fn&& fn) const
+        {
+            for (const StateShard& shard : _shards)
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.lock);
+                for (const auto& [key, state] : shard.states)
+                    fn(static_cast<int32>(key >> 32), static_cast<uint32>(key), *state);
+            }
+        }
 
     private:
+        typedef std::unordered_map<uint64, std::shared_ptr<EclipseMessageQueue>> MailboxMap;
+
+        static constexpr uint32 SHARD_BITS = 4;
+        static constexpr uint32 SHARD_COUNT = 1 << SHARD_BITS;
+
+        struct alignas(64) StateShard
+        {
+            mutable std::shared_mutex lock;
+            std::unordered_map<uint64, std::unique_ptr<EclipseSolState>> states;
+        };
+
         EclipseStateManager() = default;
         ~EclipseStateManager() = default;
         EclipseStateManager(const EclipseStateManager&) = delete;
         EclipseStateManager& operator=(const EclipseStateManager&) = delete;
 
-        std::unordered_map<int32, std::unique_ptr<EclipseSolState>> _states;
+        // Instances of one map differ in the low bits only, the key is mixed before picking a shard
+        StateShard& GetShard(uint64 key) { return _shards[((key ^ (key >> 32)) * 0x9E3779B97F4A7C15ull) >> (64 - SHARD_BITS)]; }
+        const StateShard& GetShard(uint64 key) const { return _shards[((key ^ (key >> 32)) * 0x9E3779B97F4A7C15ull) >> (64 - SHARD_BITS)]; }
+
+        EclipseSolState* FindState(uint64 key) const;
+        bool DestroyState(uint64 key);
+
+        void RegisterMailbox(uint64 key, std::shared_ptr<EclipseMessageQueue> mailbox);
+        void UnregisterMailbox(uint64 key);
+
+        std::array<StateShard, SHARD_COUNT> _shards;
+
+        // Senders read the published snapshot without locking, creating and destroying states copies it
+        std::atomic<std::shared_ptr<const MailboxMap>> _mailboxes{ std::make_shared<const MailboxMap>() };
+        std::mutex _mailboxesLock;
+
+        std::future<bool> _reload;
 
     protected:
         bool RunFromCache(sol::state& solState, const std::string& filePath, sol::table& modules, const std::string& filename, uint32& compiledCount, uint32& cachedCount);
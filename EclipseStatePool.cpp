@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseStatePool.hpp"
+#include "EclipseScriptLoader.hpp"
+#include "EclipseCache.hpp"
+#include "EclipseLogger.hpp"
+
+#include <algorithm>
+
+EclipseStatePool& EclipseStatePool::GetInstance()
+{
+    static EclipseStatePool instance;
+    return instance;
+}
+
+EclipseStatePool::~EclipseStatePool()
+{
+    Stop();
+}
+
+/**
+ *
+ */
+void EclipseStatePool::Start(uint32 size, uint32 refillThreshold)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_running || !size)
+        return;
+
+    _size = size;
+    _refillThreshold = std::min(refillThreshold, size - 1);
+    _refilling = true;
+    _running = true;
+    _thread = std::thread(&EclipseStatePool::Run, this);
+
+    ECLIPSE_LOG_INFO("[Eclipse]: State pool started (size: {}, refill below: {})", _size, _refillThreshold);
+}
+
+/**
+ *
+ */
+void EclipseStatePool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if (!_running)
+            return;
+
+        _running = false;
+    }
+
+    _condition.notify_all();
+    if (_thread.joinable())
+        _thread.join();
+
+    std::vector<std::unique_ptr<EclipseSolState>> states;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        states.swap(_states);
+    }
+}
+
+/**
+ *
+ */
+std::unique_ptr<EclipseSolState> EclipseStatePool::Acquire()
+{
+    std::unique_ptr<EclipseSolState> state;
+    std::vector<std::unique_ptr<EclipseSolState>> staleStates;
+    uint32 generation = EclipseScriptLoader::GetGeneration()->id;
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+
+        // States built against an older script generation are useless after a reload,
+        // they are closed once the lock is released
+        while (!_states.empty() && !state)
+        {
+            if (_states.back()->GetScriptGeneration() == generation)
+                state = std::move(_states.back());
+            else
+                staleStates.push_back(std::move(_states.back()));
+
+            _states.pop_back();
+        }
+
+        if (NeedsRefill())
+            _refilling = true;
+    }
+
+    _condition.notify_one();
+    return state;
+}
+
+/**
+ *
+ */
+void EclipseStatePool::Flush()
+{
+    std::vector<std::unique_ptr<EclipseSolState>> states;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        states.swap(_states);
+        _refilling = _running;
+    }
+
+    _condition.notify_one();
+}
+
+/**
+ *
+ */
+std::size_t EclipseStatePool::GetAvailableCount()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _states.size();
+}
+
+/**
+ *
+ */
+bool EclipseStatePool::NeedsRefill() const
+{
+    return _states.size() <= _refillThreshold;
+}
+
+/**
+ *
+ */
+void EclipseStatePool::Run()
+{
+    std::unique_lock<std::mutex> lock(_lock);
+    while (_running)
+    {
+        _condition.wait(lock, [this] { return !_running || _refilling; });
+        if (!_running)
+            break;
+
+        if (_states.size() >= _size || EclipseCache::GetInstance().GetCacheState() != SCRIPT_CACHE_READY)
+        {
+            _refilling = false;
+            continue;
+        }
+
+        lock.unlock();
+
+        // The state pins the generation it runs, a reload published meanwhile only makes it stale
+        auto state = std::make_unique<EclipseSolState>(nullptr, false);
+        if (state->IsInitialized())
+            state->RunExtensions();
+
+        lock.lock();
+        if (!state->IsInitialized())
+        {
+            ECLIPSE_LOG_ERROR("[Eclipse]: Unable to prepare a pooled Lua state, refill paused");
+            _refilling = false;
+            continue;
+        }
+
+        if (state->GetScriptGeneration() == EclipseScriptLoader::GetGeneration()->id)
+            _states.push_back(std::move(state));
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_STATE_POOL_HPP
+#define ECLIPSE_STATE_POOL_HPP
+
+#include "EclipseIncludes.hpp"
+#include "EclipseSolState.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Keeps states with libraries opened and extensions executed ready for new maps,
+// refilled in the background once it drops below the refill threshold
+class EclipseStatePool
+{
+    public:
+        static EclipseStatePool& GetInstance();
+
+        void Start(uint32 size, uint32 refillThreshold);
+        void Stop();
+        bool IsRunning() const { return _running.load(std::memory_order_acquire); }
+
+        std::unique_ptr<EclipseSolState> Acquire();
+        void Flush();
+
+        std::size_t GetAvailableCount();
+
+    private:
+        EclipseStatePool() = default;
+        ~EclipseStatePool();
+        EclipseStatePool(const EclipseStatePool&) = delete;
+        EclipseStatePool& operator=(const EclipseStatePool&) = delete;
+
+        void Run();
+        bool NeedsRefill() const;
+
+        std::vector<std::unique_ptr<EclipseSolState>> _states;
+        std::mutex _lock;
+        std::condition_variable _condition;
+        std::thread _thread;
+        std::atomic<bool> _running{ false };    // written under _lock, read without it by the world thread
+        bool _refilling = false;
+
+        uint32 _size = 0;
+        uint32 _refillThreshold = 0;
+};
+
+#endif // ECLIPSE_STATE_POOL_HPP
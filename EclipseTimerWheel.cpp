@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#include "EclipseTimerWheel.hpp"
+
+#include <algorithm>
+
+EclipseTimerWheel::EclipseTimerWheel() :
+_now(0),
+_count(0)
+{
+    static_assert(MAX_DELAY == (uint64(1) << (LEVEL_COUNT * SLOT_BITS)) - 1);
+
+    _slots.fill(INVALID_INDEX);
+    _tails.fill(INVALID_INDEX);
+}
+
+/**
+ * Delays are in ticks, a timer never fires in the tick it was scheduled in
+ */
+EclipseTimerWheel::TimerId EclipseTimerWheel::Schedule(uint64 delay, uint32 payload)
+{
+    uint32 index;
+    if (!_freeTimers.empty())
+    {
+        index = _freeTimers.back();
+        _freeTimers.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32>(_timers.size());
+        _timers.emplace_back();
+    }
+
+    Timer& timer = _timers[index];
+    timer.expiry = _now + std::clamp<uint64>(delay, 1, MAX_DELAY);
+    timer.payload = payload;
+
+    Link(index);
+    ++_count;
+    return MakeId(index, timer.generation);
+}
+
+/**
+ *
+ */
+bool EclipseTimerWheel::Cancel(TimerId id)
+{
+    if (!FindTimer(id))
+        return false;
+
+    uint32 index = static_cast<uint32>(id);
+    Unlink(index);
+    Release(index);
+    return true;
+}
+
+/**
+ *
+ */
+bool EclipseTimerWheel::IsScheduled(TimerId id) const
+{
+    return FindTimer(id) != nullptr;
+}
+
+/**
+ *
+ */
+void EclipseTimerWheel::Clear()
+{
+    for (uint32 index = 0; index < _timers.size(); ++index)
+        if (_timers[index].slot != INVALID_INDEX)
+            Release(index);
+
+    _slots.fill(INVALID_INDEX);
+    _tails.fill(INVALID_INDEX);
+}
+
+/**
+ *
+ */
+void EclipseTimerWheel::Advance(uint64 elapsed, std::vector<ExpiredTimer>& expired)
+{
+    // Nothing can cascade or expire, slots only matter relative to pending timers
+    if (!_count)
+    {
+        _now += elapsed;
+        return;
+    }
+
+    for (uint64 target = _now + elapsed; _now < target && _count;)
+    {
+        uint64 tick = _now + 1;
+
+        // Every wrap of a level pulls the next slot of the level above down
+        for (uint32 level = 1; level < LEVEL_COUNT && !((tick >> ((level - 1) * SLOT_BITS)) & SLOT_MASK); ++level)
+            Cascade(level, tick);
+
+        _now = tick;
+
+        uint32& head = _slots[tick & SLOT_MASK];
+        while (head != INVALID_INDEX)
+        {
+            uint32 index = head;
+            Unlink(index);
+            expired.push_back({ MakeId(index, _timers[index].generation), _timers[index].payload });
+            Release(index);
+        }
+
+        if (!_count)
+            _now = target;
+    }
+}
+
+/**
+ *
+ */
+const EclipseTimerWheel::Timer* EclipseTimerWheel::FindTimer(TimerId id) const
+{
+    uint32 index = static_cast<uint32>(id);
+    if (index >= _timers.size())
+        return nullptr;
+
+    const Timer& timer = _timers[index];
+    return timer.slot != INVALID_INDEX && timer.generation == static_cast<uint32>(id >> 32) ? &timer : nullptr;
+}
+
+/**
+ * Level is picked from the distance to the next tick, the slot from the expiry bits of that level.
+ * New timers go to the back of their slot, cascading ones to the front (see Cascade).
+ */
+void EclipseTimerWheel::Link(uint32 index, bool front)
+{
+    Timer& timer = _timers[index];
+    uint64 delta = timer.expiry - (_now + 1);
+
+    uint32 level = 0;
+    while (level + 1 < LEVEL_COUNT && delta >= (uint64(1) << ((level + 1) * SLOT_BITS)))
+        ++level;
+
+    timer.slot = level * SLOT_COUNT + static_cast<uint32>((timer.expiry >> (level * SLOT_BITS)) & SLOT_MASK);
+    if (front)
+    {
+        timer.prev = INVALID_INDEX;
+        timer.next = _slots[timer.slot];
+
+        if (timer.next != INVALID_INDEX)
+            _timers[timer.next].prev = index;
+        else
+            _tails[timer.slot] = index;
+
+        _slots[timer.slot] = index;
+    }
+    else
+    {
+        timer.prev = _tails[timer.slot];
+        timer.next = INVALID_INDEX;
+
+        if (timer.prev != INVALID_INDEX)
+            _timers[timer.prev].next = index;
+        else
+            _slots[timer.slot] = index;
+
+        _tails[timer.slot] = index;
+    }
+}
+
+/**
+ *
+ */
+void EclipseTimerWheel::Unlink(uint32 index)
+{
+    Timer& timer = _timers[index];
+
+    if (timer.prev != INVALID_INDEX)
+        _timers[timer.prev].next = timer.next;
+    else
+        _slots[timer.slot] = timer.next;
+
+    if (timer.next != INVALID_INDEX)
+        _timers[timer.next].prev = timer.prev;
+    else
+        _tails[timer.slot] = timer.prev;
+
+    timer.prev = INVALID_INDEX;
+    timer.next = INVALID_INDEX;
+}
+
+/**
+ * Generation bump invalidates every id handed out for the slot
+ */
+void EclipseTimerWheel::Release(uint32 index)
+{
+    Timer& timer = _timers[index];
+    timer.slot = INVALID_INDEX;
+    ++timer.generation;
+
+    _freeTimers.push_back(index);
+    --_count;
+}
+
+/**
+ * Timers of the slot are relinked relative to `tick`, they land on lower levels. A timer on a higher
+ * level was scheduled before any timer with the same expiry on a lower one, so cascading timers go
+ * in front of the ones already there, walked from the back to keep their own order.
+ */
+void EclipseTimerWheel::Cascade(uint32 level, uint64 tick)
+{
+    uint32 slot = level * SLOT_COUNT + static_cast<uint32>((tick >> (level * SLOT_BITS)) & SLOT_MASK);
+    uint32 index = _tails[slot];
+    _slots[slot] = INVALID_INDEX;
+    _tails[slot] = INVALID_INDEX;
+
+    // Link computes levels from the next tick to process, which is `tick` here
+    uint64 now = _now;
+    _now = tick - 1;
+
+    while (index != INVALID_INDEX)
+    {
+        uint32 prev = _timers[index].prev;
+        Link(index, true);
+        index = prev;
+    }
+
+    _now = now;
+}
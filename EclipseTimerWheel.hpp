@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+#ifndef ECLIPSE_TIMER_WHEEL_HPP
+#define ECLIPSE_TIMER_WHEEL_HPP
+
+#include "Common.h"
+
+#include <array>
+#include <vector>
+
+// Hierarchical timer wheel with millisecond ticks, 4 levels of 256 slots covering ~49 days.
+// Timers live in a slab and are linked into their slot by index, insert and cancel are O(1),
+// advancing costs one slot per elapsed tick plus the timers that actually cascade or expire.
+class EclipseTimerWheel
+{
+    public:
+        typedef uint64 TimerId;
+
+        static constexpr TimerId INVALID_TIMER = 0;
+        static constexpr uint64 MAX_DELAY = (uint64(1) << 32) - 1; // LEVEL_COUNT * SLOT_BITS bits
+
+        struct ExpiredTimer
+        {
+            TimerId id;
+            uint32 payload;
+        };
+
+        EclipseTimerWheel();
+
+        TimerId Schedule(uint64 delay, uint32 payload);
+        bool Cancel(TimerId id);
+        bool IsScheduled(TimerId id) const;
+        void Clear();
+
+        // Expired timers are appended in expiry order, timers expiring on the same tick in the order
+        // they were scheduled. They are already released.
+        void Advance(uint64 elapsed, std::vector<ExpiredTimer>& expired);
+
+        uint64 GetTime() const { return _now; }
+        std::size_t GetCount() const { return _count; }
+
+    private:
+        static constexpr uint32 LEVEL_COUNT = 4;
+        static constexpr uint32 SLOT_BITS = 8;
+        static constexpr uint32 SLOT_COUNT = 1 << SLOT_BITS;
+        static constexpr uint32 SLOT_MASK = SLOT_COUNT - 1;
+        static constexpr uint32 INVALID_INDEX = 0xFFFFFFFF;
+
+        struct Timer
+        {
+            uint64 expiry = 0;
+            uint32 payload = 0;
+            uint32 generation = 1;
+            uint32 prev = INVALID_INDEX;
+            uint32 next = INVALID_INDEX;
+            uint32 slot = INVALID_INDEX; // level * SLOT_COUNT + slot index, INVALID_INDEX when free
+        };
+
+        static TimerId MakeId(uint32 index, uint32 generation) { return (uint64(generation) << 32) | index; }
+        const Timer* FindTimer(TimerId id) const;
+
+        void Link(uint32 index, bool front = false);
+        void Unlink(uint32 index);
+        void Release(uint32 index);
+        void Cascade(uint32 level, uint64 tick);
+
+        uint64 _now; // last processed tick
+        std::size_t _count;
+        std::vector<Timer> _timers;
+        std::vector<uint32> _freeTimers;
+        std::array<uint32, LEVEL_COUNT * SLOT_COUNT> _slots;
+        std::array<uint32, LEVEL_COUNT * SLOT_COUNT> _tails;
+};
+
+#endif // ECLIPSE_TIMER_WHEEL_HPP
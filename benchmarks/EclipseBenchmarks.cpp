@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2010 - 2024 Eluna Lua Engine <https://elunaluaengine.github.io/>
+ * This program is free software licensed under GPL version 3
+ * Please see the included LICENSE.md for more information
+ */
+
+// Only built by benchmarks/CMakeLists.txt, the core globs every source of the module
+#ifdef ECLIPSE_BENCHMARKS
+
+#include "EclipseIncludes.hpp"
+#include "EclipseScriptLoader.hpp"
+#include "EclipseStateManager.hpp"
+#include "EclipseSolState.hpp"
+#include "EclipseCompiler.hpp"
+#include "EclipseConfig.hpp"
+#include "EclipseCache.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace
+{
+    constexpr uint32 TREE_FANOUT = 16;
+    constexpr uint32 REQUIRE_INTERVAL = 4;
+
+    int GetHardwareThreads()
+    {
+        return static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+
+    // Every module exposes a few functions doing table, string and arithmetic work,
+    // one in REQUIRE_INTERVAL also requires its predecessor so the loader resolves modules
+    std::string GenerateScript(uint32 index, uint32 functionCount)
+    {
+        std::ostringstream script;
+        script << "local M = {}\n";
+
+        if (index > 0 && index % REQUIRE_INTERVAL == 0)
+            script << "local previous = require(\"bench_" << index - 1 << "\")\n";
+
+        for (uint32 i = 0; i < functionCount; ++i)
+        {
+            script << "function M.func_" << i << "(count)\n"
+                   << "    local values = {}\n"
+                   << "    for i = 1, count do\n"
+                   << "        values[#values + 1] = string.format(\"%d:%d\", i, " << index << ")\n"
+                   << "    end\n"
+                   << "    return table.concat(values, \",\"), math.floor(count * " << i + 1 << " / 3)\n"
+                   << "end\n";
+        }
+
+        script << "M.name = \"bench_" << index << "\"\n"
+               << "M.size = " << functionCount << "\n"
+               << "return M\n";
+        return script.str();
+    }
+
+    // Synthetic script tree on disk, files are spread over `depth` levels of TREE_FANOUT directories
+    class ScriptTree
+    {
+        public:
+            ScriptTree(uint32 fileCount, uint32 depth, uint32 functionCount) :
+            _root(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("eclipse-bench-%%%%-%%%%"))
+            {
+                for (uint32 index = 0; index < fileCount; ++index)
+                {
+                    boost::filesystem::path directory = _root;
+                    for (uint32 level = 0, bucket = index; level < depth; ++level, bucket /= TREE_FANOUT)
+                        directory /= "dir_" + std::to_string(bucket % TREE_FANOUT);
+
+                    boost::filesystem::create_directories(directory);
+
+                    std::ofstream file((directory / ("bench_" + std::to_string(index) + ".lua")).string(), std::ios::trunc);
+                    file << GenerateScript(index, functionCount);
+                }
+            }
+
+            ~ScriptTree()
+            {
+                boost::system::error_code error;
+                boost::filesystem::remove_all(_root, error);
+            }
+
+            std::string GetRoot() const { return _root.string(); }
+
+        private:
+            boost::filesystem::path _root;
+    };
+
+    // Trees are expensive to write, they are shared by every benchmark for the whole run
+    const ScriptTree& GetScriptTree(uint32 fileCount)
+    {
+        static std::mutex treesLock;
+        static std::map<uint32, std::unique_ptr<ScriptTree>> trees;
+
+        std::lock_guard<std::mutex> guard(treesLock);
+        auto& tree = trees[fileCount];
+        if (!tree)
+            tree = std::make_unique<ScriptTree>(fileCount, fileCount >= 10000 ? 3 : 2, 4);
+
+        return *tree;
+    }
+
+    void ConfigureEngine(const ScriptTree& tree, uint32 compilerThreads)
+    {
+        EclipseConfig& config = EclipseConfig::GetInstance();
+        config.Initialize();
+        config.OverwriteConfigValue<std::string>(EclipseConfigValues::SCRIPT_PATH, tree.GetRoot());
+        config.OverwriteConfigValue<uint32>(EclipseConfigValues::COMPILER_THREADS, compilerThreads);
+    }
+
+    bool ReloadEngine(bool coldCache)
+    {
+        EclipseCache& cache = EclipseCache::GetInstance();
+        if (coldCache)
+            cache.InvalidateAllScripts();
+
+        cache.SetCacheState(SCRIPT_CACHE_REINIT);
+        return EclipseScriptLoader::LoadScriptPaths();
+    }
+
+    // Benchmarks running after a load share its result, only reload when the tree changes
+    void EnsureScriptsLoaded(uint32 fileCount)
+    {
+        static std::mutex loadLock;
+        static uint32 loadedFileCount = 0;
+
+        std::lock_guard<std::mutex> guard(loadLock);
+        if (loadedFileCount == fileCount)
+            return;
+
+        ConfigureEngine(GetScriptTree(fileCount), 0);
+        ReloadEngine(true);
+        loadedFileCount = fileCount;
+    }
+
+    std::vector<std::string> GetLoadedScriptPaths()
+    {
+        std::shared_ptr<const ScriptGeneration> generation = EclipseScriptLoader::GetGeneration();
+
+        std::vector<std::string> paths;
+        for (const auto& [fileName, script] : generation->scripts)
+            paths.push_back(script.filePath);
+
+        return paths;
+    }
+}
+
+/**
+ * Full discovery and compilation with an empty cache, args: file count, compiler threads
+ */
+static void BM_LoadScriptPaths_Cold(benchmark::State& state)
+{
+    uint32 fileCount = static_cast<uint32>(state.range(0));
+    ConfigureEngine(GetScriptTree(fileCount), static_cast<uint32>(state.range(1)));
+
+    for (auto _ : state)
+    {
+        if (!ReloadEngine(true))
+            state.SkipWithError("LoadScriptPaths failed");
+    }
+
+    state.SetItemsProcessed(state.iterations() * fileCount);
+}
+
+/**
+ * Rescan of an unchanged tree, every script is served by the metadata pre-check
+ */
+static void BM_LoadScriptPaths_Warm(benchmark::State& state)
+{
+    uint32 fileCount = static_cast<uint32>(state.range(0));
+    ConfigureEngine(GetScriptTree(fileCount), static_cast<uint32>(state.range(1)));
+    ReloadEngine(true);
+
+    for (auto _ : state)
+    {
+        if (!ReloadEngine(false))
+            state.SkipWithError("LoadScriptPaths failed");
+    }
+
+    state.SetItemsProcessed(state.iterations() * fileCount);
+}
+
+/**
+ * Startup from a bundle packed from the tree, one mapping instead of the walk, arg: file count
+ */
+static void BM_LoadScriptBundle(benchmark::State& state)
+{
+    uint32 fileCount = static_cast<uint32>(state.range(0));
+    const ScriptTree& tree = GetScriptTree(fileCount);
+    std::string bundlePath = tree.GetRoot() + "/scripts.bundle";
+
+    ConfigureEngine(tree, 0);
+    if (!ReloadEngine(true) || !EclipseScriptLoader::WriteScriptBundle(bundlePath))
+    {
+        state.SkipWithError("WriteScriptBundle failed");
+        return;
+    }
+
+    EclipseConfig::GetInstance().OverwriteConfigValue<std::string>(EclipseConfigValues::SCRIPT_BUNDLE, bundlePath);
+    for (auto _ : state)
+    {
+        if (!ReloadEngine(true))
+            state.SkipWithError("LoadScriptPaths failed");
+    }
+
+    state.SetItemsProcessed(state.iterations() * fileCount);
+    EclipseConfig::GetInstance().OverwriteConfigValue<std::string>(EclipseConfigValues::SCRIPT_BUNDLE, "");
+}
+
+/**
+ * Compilation of a single in-memory chunk, arg: function count of the script
+ */
+static void BM_CompileLuaToByteCode(benchmark::State& state)
+{
+    sol::state solState;
+    std::string source = GenerateScript(1, static_cast<uint32>(state.range(0)));
+    std::string filePath = "bench_1.lua";
+
+    for (auto _ : state)
+    {
+        std::optional<sol::bytecode> bytecode = EclipseCompiler::CompileLuaToByteCode(solState, filePath, source);
+        benchmark::DoNotOptimize(bytecode);
+    }
+
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(source.size()));
+}
+
+/**
+ * Cache lookups from map threads, arg: file count
+ */
+static void BM_GetBytecode(benchmark::State& state)
+{
+    EnsureScriptsLoaded(static_cast<uint32>(state.range(0)));
+
+    std::vector<std::string> paths = GetLoadedScriptPaths();
+    if (paths.empty())
+    {
+        state.SkipWithError("No scripts loaded");
+        return;
+    }
+
+    const EclipseCache& cache = EclipseCache::GetInstance();
+    std::size_t index = static_cast<std::size_t>(state.thread_index()) * 7919 % paths.size();
+
+    for (auto _ : state)
+    {
+        ScriptBytecode bytecode = cache.GetBytecode(paths[index]);
+        benchmark::DoNotOptimize(bytecode);
+        if (++index == paths.size())
+            index = 0;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * State creation through the manager, every iteration targets a new instance of the same map
+ * and destroys it untimed the way an instance unload would, arg: file count
+ */
+static void BM_CreateState(benchmark::State& state)
+{
+    EnsureScriptsLoaded(static_cast<uint32>(state.range(0)));
+
+    EclipseStateManager& stateManager = EclipseStateManager::GetInstance();
+    uint32 instanceId = 0;
+
+    for (auto _ : state)
+    {
+        Map map(1, ++instanceId, BENCHMARK_MAP_INSTANCE);
+        benchmark::DoNotOptimize(stateManager.CreateState(&map));
+
+        state.PauseTiming();
+        stateManager.DestroyState(&map);
+        state.ResumeTiming();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * Concurrent state creation, the manager is only touched from the world thread so each
+ * thread builds its own states the way map threads would, arg: file count
+ */
+static void BM_CreateState_Parallel(benchmark::State& state)
+{
+    EnsureScriptsLoaded(static_cast<uint32>(state.range(0)));
+
+    Map map(100000 + static_cast<uint32>(state.thread_index()));
+
+    for (auto _ : state)
+    {
+        auto solState = std::make_unique<EclipseSolState>(&map);
+        benchmark::DoNotOptimize(solState.get());
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * Execution of every loaded script in an already initialized state, arg: file count
+ */
+static void BM_RunScripts(benchmark::State& state)
+{
+    uint32 fileCount = static_cast<uint32>(state.range(0));
+    EnsureScriptsLoaded(fileCount);
+
+    Map map(200000 + static_cast<uint32>(state.thread_index()));
+    EclipseSolState solState(&map, false);
+
+    for (auto _ : state)
+        solState.RunScripts();
+
+    state.SetItemsProcessed(state.iterations() * fileCount);
+    state.counters["state_bytes"] = static_cast<double>(solState.GetMemoryUsage());
+}
+
+BENCHMARK(BM_LoadScriptPaths_Cold)
+    ->ArgsProduct({ { 1000, 10000, 50000 }, { 1, GetHardwareThreads() } })
+    ->ArgNames({ "files", "threads" })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_LoadScriptPaths_Warm)
+    ->ArgsProduct({ { 1000, 10000, 50000 }, { 1, GetHardwareThreads() } })
+    ->ArgNames({ "files", "threads" })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_LoadScriptBundle)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Arg(50000)
+    ->ArgName("files")
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_CompileLuaToByteCode)
+    ->RangeMultiplier(4)
+    ->Range(1, 256)
+    ->ArgName("functions")
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK(BM_GetBytecode)
+    ->Arg(10000)
+    ->ArgName("files")
+    ->ThreadRange(1, GetHardwareThreads())
+    ->UseRealTime();
+
+BENCHMARK(BM_CreateState)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->ArgName("files")
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK(BM_CreateState_Parallel)
+    ->Arg(1000)
+    ->ArgName("files")
+    ->ThreadRange(1, GetHardwareThreads())
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK(BM_RunScripts)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->ArgName("files")
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK(BM_RunScripts)
+    ->Arg(1000)
+    ->ArgName("files")
+    ->ThreadRange(2, GetHardwareThreads())
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
+
+#endif // ECLIPSE_BENCHMARKS